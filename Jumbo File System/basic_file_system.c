@@ -1,4 +1,158 @@
 #include "basic_file_system.h"
+#include <string.h>
+
+// in-memory copy of the superblock, valid while mounted
+static struct superblock sb;
+
+// in-memory copy of the snapshot table (empty if sb.snapshot_block is 0)
+static struct snapshot_table snapshots;
+
+// union of all snapshot bitmaps: blocks that may not be allocated or changed
+static unsigned char frozen[BLOCK_SIZE];
+
+// blocks allocated since mount (see bfs_num_allocations())
+static uint64_t num_allocations;
+
+// in-memory copy of the reference count table (all 0 if there is none)
+static unsigned char refcounts[NUM_BLOCKS];
+
+
+// writes the in-memory superblock to disk
+static int write_superblock() {
+  char buf[BLOCK_SIZE];
+  memset(buf, 0, BLOCK_SIZE);
+  memcpy(buf, &sb, sizeof(sb));
+  return write_block(SUPERBLOCK_BLOCK, buf);
+}
+
+
+// writes an empty bitmap and a new superblock to a fresh (all zero) image
+static int format() {
+  char bitmap[BLOCK_SIZE];
+  memset(bitmap, 0, BLOCK_SIZE);
+  // the bitmap, root directory and superblock are always allocated
+  bitmap[0] = (1 << BITMAP_BLOCK) | (1 << ROOT_BLOCK) | (1 << SUPERBLOCK_BLOCK);
+  if (write_block(BITMAP_BLOCK, bitmap) < 0) {
+    return -1;
+  }
+
+  // no field may be left over from an earlier mount
+  memset(&sb, 0, sizeof(sb));
+  sb.magic = JFS_MAGIC;
+  sb.version = JFS_VERSION;
+  sb.state = FS_DIRTY;
+  sb.num_blocks = NUM_BLOCKS;
+  sb.free_blocks = NUM_BLOCKS - 3;
+  sb.root_block = ROOT_BLOCK;
+  sb.snapshot_block = 0;
+  return write_superblock();
+}
+
+
+// counts the blocks that are neither allocated nor frozen by scanning the bitmap
+static int count_free_blocks() {
+  unsigned char bitmap[BLOCK_SIZE];
+  if (read_block(BITMAP_BLOCK, bitmap) < 0) {
+    return -1;
+  }
+  int free_blocks = 0;
+  for (int byte = 0; byte < BLOCK_SIZE; byte++) {
+    free_blocks += 8 - __builtin_popcount(bitmap[byte] | frozen[byte]);
+  }
+  return free_blocks;
+}
+
+
+// recomputes the free-block count after many blocks changed state at once
+static int recount_free_blocks() {
+  int free_blocks = count_free_blocks();
+  if (free_blocks < 0) {
+    return -1;
+  }
+  sb.free_blocks = free_blocks;
+  return 0;
+}
+
+
+// recomputes the frozen blocks from the bitmaps of all snapshots
+static int rebuild_frozen() {
+  memset(frozen, 0, BLOCK_SIZE);
+  for (int i = 0; i < snapshots.num_snapshots; i++) {
+    unsigned char bitmap[BLOCK_SIZE];
+    if (read_block(snapshots.snapshots[i].bitmap_block, bitmap) < 0) {
+      return -1;
+    }
+    for (int byte = 0; byte < BLOCK_SIZE; byte++) {
+      frozen[byte] |= bitmap[byte];
+    }
+  }
+  return 0;
+}
+
+
+// sets (allocated = 1) or clears (allocated = 0) the bits of the metadata
+// blocks in a bitmap: the bitmap, superblock, snapshot table and snapshot bitmaps
+static void mark_metadata(unsigned char* bitmap, int allocated) {
+  block_num_t metadata[MAX_SNAPSHOTS + REFCOUNT_BLOCKS + 3];
+  int count = 0;
+  metadata[count++] = BITMAP_BLOCK;
+  metadata[count++] = SUPERBLOCK_BLOCK;
+  if (sb.snapshot_block != 0) {
+    metadata[count++] = sb.snapshot_block;
+  }
+  if (sb.refcount_blocks[0] != 0) {
+    for (int i = 0; i < REFCOUNT_BLOCKS; i++) {
+      metadata[count++] = sb.refcount_blocks[i];
+    }
+  }
+  for (int i = 0; i < snapshots.num_snapshots; i++) {
+    metadata[count++] = snapshots.snapshots[i].bitmap_block;
+  }
+
+  for (int i = 0; i < count; i++) {
+    unsigned char mask = 1 << (metadata[i] % 8);
+    if (allocated) {
+      bitmap[metadata[i] / 8] |= mask;
+    } else {
+      bitmap[metadata[i] / 8] &= ~mask;
+    }
+  }
+}
+
+
+// writes the part of the in-memory reference count table holding a block's count
+static int write_refcount(block_num_t block) {
+  int i = block / BLOCK_SIZE;
+  return write_block(sb.refcount_blocks[i], refcounts + i * BLOCK_SIZE);
+}
+
+
+// writes the in-memory snapshot table to disk
+static int write_snapshot_table() {
+  char buf[BLOCK_SIZE];
+  memset(buf, 0, BLOCK_SIZE);
+  memcpy(buf, &snapshots, sizeof(snapshots));
+  return write_block(sb.snapshot_block, buf);
+}
+
+
+// returns 1 if a block is all zeros
+static int is_zero(const char* block) {
+  for (int i = 0; i < BLOCK_SIZE; i++) {
+    if (block[i] != 0) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+// unmounts the raw disk after a failed bfs_mount(), so that its lock does not
+// keep the image from being mounted again
+static int fail_mount() {
+  raw_unmount();
+  return -1;
+}
 
 
 int bfs_mount(const char* filename) {
@@ -7,34 +161,81 @@ int bfs_mount(const char* filename) {
     return -1;
   }
 
-  // read the superblock
-  char superblock[BLOCK_SIZE];
-  if (read_block(0, superblock) < 0) {
-    return -1;
+  // read the superblock; on a clean image this is the only read needed
+  char buf[BLOCK_SIZE];
+  if (read_block(SUPERBLOCK_BLOCK, buf) < 0) {
+    return fail_mount();
   }
+  memcpy(&sb, buf, sizeof(sb));
+  memset(&snapshots, 0, sizeof(snapshots));
+  memset(frozen, 0, BLOCK_SIZE);
+  memset(refcounts, 0, NUM_BLOCKS);
 
-  // make sure the superblock and root directory are marked "allocated"
-  if (!(superblock[0] & 3)) {
-    superblock[0] |= 3;
-    if (write_block(0, superblock) < 0) {
-      return -1;
+  if (sb.magic != JFS_MAGIC) {
+    // only a fresh image (all zeros, as raw_mount() creates or extends it) is
+    // formatted; anything else is the wrong file or a damaged superblock, and
+    // formatting it would throw away whatever it holds
+    char bitmap[BLOCK_SIZE];
+    if (!is_zero(buf) || read_block(BITMAP_BLOCK, bitmap) < 0 || !is_zero(bitmap) ||
+        format() < 0) {
+      return fail_mount();
+    }
+    return 1;
+  }
+  if (sb.version != JFS_VERSION || sb.num_blocks != NUM_BLOCKS) {
+    return fail_mount();
+  }
+
+  if (sb.snapshot_block != 0) {
+    // only images with snapshots need more than the superblock read
+    if (read_block(sb.snapshot_block, buf) < 0) {
+      return fail_mount();
+    }
+    memcpy(&snapshots, buf, sizeof(snapshots));
+    if (rebuild_frozen() < 0) {
+      return fail_mount();
+    }
+  }
+
+  if (sb.refcount_blocks[0] != 0) {
+    for (int i = 0; i < REFCOUNT_BLOCKS; i++) {
+      if (read_block(sb.refcount_blocks[i], refcounts + i * BLOCK_SIZE) < 0) {
+        return fail_mount();
+      }
     }
   }
+
+  if (sb.state != FS_CLEAN) {
+    // not unmounted cleanly, so the saved free-block count may be stale
+    if (recount_free_blocks() < 0) {
+      return fail_mount();
+    }
+  }
+
+  // mark the image as in use until bfs_unmount()
+  sb.state = FS_DIRTY;
+  if (write_superblock() < 0) {
+    return fail_mount();
+  }
   return 0;
 }
 
 
 block_num_t allocate_block() {
+  if (sb.free_blocks == 0) {
+    return 0; // no free blocks
+  }
+
   // read the superblock
   char superblock[BLOCK_SIZE];
   if (read_block(0, superblock) < 0) {
     return 0;
   }
 
-  // find the first byte that is all allocated
+  // find the first byte that is all allocated (frozen blocks count as allocated)
   int byte;
   for (byte = 0;
-       byte < BLOCK_SIZE && superblock[byte] == (char)-1;
+       byte < BLOCK_SIZE && (unsigned char)(superblock[byte] | frozen[byte]) == 0xff;
        byte++) {}
   // if all bytes are all allocated, then there are no free blocks
   if (byte == BLOCK_SIZE) {
@@ -42,7 +243,7 @@ block_num_t allocate_block() {
   }
 
   // find the bit index of the first 0 bit
-  unsigned char field = superblock[byte];
+  unsigned char field = superblock[byte] | frozen[byte];
   int bit;
   for (bit = 0; field & 1 && bit < 8; field >>= 1, bit++) {}
   if (bit == 8) {
@@ -57,11 +258,57 @@ block_num_t allocate_block() {
   if (write_block(0, superblock) < 0) {
     return 0;
   }
+  sb.free_blocks--;
+  num_allocations++;
   return byte * 8 + bit;
 }
 
 
+int allocate_blocks(block_num_t count, block_num_t* blocks) {
+  if (count > sb.free_blocks) {
+    return -1; // not enough free blocks
+  }
+
+  // read the bitmap
+  unsigned char bitmap[BLOCK_SIZE];
+  if (read_block(BITMAP_BLOCK, bitmap) < 0) {
+    return -1;
+  }
+
+  // take the first count free blocks
+  block_num_t found = 0;
+  for (int byte = 0; byte < BLOCK_SIZE && found < count; byte++) {
+    if ((bitmap[byte] | frozen[byte]) == 0xff) {
+      continue; // all allocated
+    }
+    for (int bit = 0; bit < 8 && found < count; bit++) {
+      if (!((bitmap[byte] | frozen[byte]) & (1 << bit))) {
+        bitmap[byte] |= 1 << bit;
+        blocks[found++] = byte * 8 + bit;
+      }
+    }
+  }
+  if (found < count) {
+    return -1; // the bitmap disagrees with the free count; allocate nothing
+  }
+
+  // write the updated bitmap back to disk
+  if (write_block(BITMAP_BLOCK, bitmap) < 0) {
+    return -1;
+  }
+  sb.free_blocks -= count;
+  num_allocations += count;
+  return 0;
+}
+
+
 int release_block(block_num_t block) {
+  if (refcounts[block] > 0) {
+    // still shared, so only drop a reference
+    refcounts[block]--;
+    return write_refcount(block);
+  }
+
   // read the superblock
   char superblock[BLOCK_SIZE];
   if (read_block(0, superblock) < 0) {
@@ -70,16 +317,273 @@ int release_block(block_num_t block) {
 
   // change bit corresponding to block num to 0
   char mask = 1 << (block % 8);
+  if (!(superblock[block / 8] & mask)) {
+    return 0; // not allocated; nothing to do
+  }
   superblock[block / 8] &= ~mask;
 
   // write the updated superblock back to disk
   if (write_block(0, superblock) < 0) {
     return -1;
   }
+  if (!bfs_is_frozen(block)) {
+    sb.free_blocks++; // otherwise a snapshot keeps the block
+  }
   return 0;
 }
 
 
+int release_blocks(int count, const block_num_t* blocks) {
+  unsigned char bitmap[BLOCK_SIZE];
+  if (read_block(BITMAP_BLOCK, bitmap) < 0) {
+    return -1;
+  }
+
+  int bitmap_changed = 0;
+  int refcounts_changed[REFCOUNT_BLOCKS] = {0};
+  for (int i = 0; i < count; i++) {
+    block_num_t block = blocks[i];
+    if (refcounts[block] > 0) {
+      // still shared, so only drop a reference
+      refcounts[block]--;
+      refcounts_changed[block / BLOCK_SIZE] = 1;
+      continue;
+    }
+    unsigned char mask = 1 << (block % 8);
+    if (!(bitmap[block / 8] & mask)) {
+      continue; // not allocated; nothing to do
+    }
+    bitmap[block / 8] &= ~mask;
+    bitmap_changed = 1;
+    if (!bfs_is_frozen(block)) {
+      sb.free_blocks++; // otherwise a snapshot keeps the block
+    }
+  }
+
+  for (int i = 0; i < REFCOUNT_BLOCKS; i++) {
+    if (refcounts_changed[i] &&
+        write_block(sb.refcount_blocks[i], refcounts + i * BLOCK_SIZE) < 0) {
+      return -1;
+    }
+  }
+  if (bitmap_changed && write_block(BITMAP_BLOCK, bitmap) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+
+uint64_t bfs_num_allocations() {
+  return num_allocations;
+}
+
+
+int bfs_has_feature(uint16_t feature) {
+  return (sb.features & feature) != 0;
+}
+
+
+int bfs_set_feature(uint16_t feature, int enable) {
+  if (enable && (feature & FEATURE_DEDUP) && sb.refcount_blocks[0] == 0) {
+    // create the (all zero) reference count table
+    block_num_t table[REFCOUNT_BLOCKS];
+    if (allocate_blocks(REFCOUNT_BLOCKS, table) < 0) {
+      return -1;
+    }
+    memset(refcounts, 0, NUM_BLOCKS);
+    for (int i = 0; i < REFCOUNT_BLOCKS; i++) {
+      if (write_block(table[i], refcounts + i * BLOCK_SIZE) < 0) {
+        return -1;
+      }
+    }
+    memcpy(sb.refcount_blocks, table, sizeof(table));
+  }
+
+  if (enable) {
+    sb.features |= feature;
+  } else {
+    sb.features &= ~feature;
+  }
+  return write_superblock();
+}
+
+
+int bfs_refcount(block_num_t block) {
+  return refcounts[block];
+}
+
+
+block_num_t bfs_refcount_table() {
+  return sb.refcount_blocks[0];
+}
+
+
+int bfs_share_block(block_num_t block) {
+  if (sb.refcount_blocks[0] == 0 || refcounts[block] == MAX_REFCOUNT) {
+    return -1;
+  }
+  refcounts[block]++;
+  return write_refcount(block);
+}
+
+
+int bfs_set_refcounts(const unsigned char* new_refcounts) {
+  if (sb.refcount_blocks[0] == 0) {
+    return -1;
+  }
+  for (int i = 0; i < REFCOUNT_BLOCKS; i++) {
+    if (memcmp(refcounts + i * BLOCK_SIZE, new_refcounts + i * BLOCK_SIZE, BLOCK_SIZE) != 0) {
+      memcpy(refcounts + i * BLOCK_SIZE, new_refcounts + i * BLOCK_SIZE, BLOCK_SIZE);
+      if (write_block(sb.refcount_blocks[i], refcounts + i * BLOCK_SIZE) < 0) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+
+int bfs_is_frozen(block_num_t block) {
+  return (frozen[block / 8] >> (block % 8)) & 1;
+}
+
+
+block_num_t bfs_root() {
+  return sb.root_block;
+}
+
+
+int bfs_set_root(block_num_t block) {
+  sb.root_block = block;
+  return write_superblock();
+}
+
+
+int bfs_snapshot(const char* name) {
+  // the snapshot table is created with the first snapshot
+  int new_table = 0;
+  if (sb.snapshot_block == 0) {
+    sb.snapshot_block = allocate_block();
+    if (sb.snapshot_block == 0) {
+      return -1;
+    }
+    new_table = 1;
+  }
+  block_num_t bitmap_block = allocate_block();
+  if (bitmap_block == 0) {
+    if (new_table) {
+      release_block(sb.snapshot_block);
+      sb.snapshot_block = 0;
+    }
+    return -1;
+  }
+
+  int index = snapshots.num_snapshots++;
+  strncpy(snapshots.snapshots[index].name, name, SNAPSHOT_NAME_LENGTH);
+  snapshots.snapshots[index].name[SNAPSHOT_NAME_LENGTH] = '\0';
+  snapshots.snapshots[index].root_block = sb.root_block;
+  snapshots.snapshots[index].bitmap_block = bitmap_block;
+
+  // the snapshot's bitmap is the current bitmap without the metadata blocks
+  unsigned char bitmap[BLOCK_SIZE];
+  if (read_block(BITMAP_BLOCK, bitmap) < 0) {
+    return -1;
+  }
+  mark_metadata(bitmap, 0);
+  if (write_block(bitmap_block, bitmap) < 0 ||
+      write_snapshot_table() < 0 ||
+      (new_table && write_superblock() < 0)) {
+    return -1;
+  }
+
+  // every block in use is now shared with the snapshot
+  for (int byte = 0; byte < BLOCK_SIZE; byte++) {
+    frozen[byte] |= bitmap[byte];
+  }
+  return 0;
+}
+
+
+int bfs_find_snapshot(const char* name) {
+  for (int i = 0; i < snapshots.num_snapshots; i++) {
+    if (strncmp(snapshots.snapshots[i].name, name, SNAPSHOT_NAME_LENGTH + 1) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+int bfs_num_snapshots() {
+  return snapshots.num_snapshots;
+}
+
+
+const char* bfs_snapshot_name(int index) {
+  return snapshots.snapshots[index].name;
+}
+
+
+int bfs_rollback(int index) {
+  // the snapshot's blocks plus the metadata blocks become the allocated blocks
+  unsigned char bitmap[BLOCK_SIZE];
+  if (read_block(snapshots.snapshots[index].bitmap_block, bitmap) < 0) {
+    return -1;
+  }
+  mark_metadata(bitmap, 1);
+  if (write_block(BITMAP_BLOCK, bitmap) < 0) {
+    return -1;
+  }
+  if (bfs_set_root(snapshots.snapshots[index].root_block) < 0) {
+    return -1;
+  }
+  return recount_free_blocks();
+}
+
+
+int bfs_delete_snapshot(int index) {
+  block_num_t bitmap_block = snapshots.snapshots[index].bitmap_block;
+  for (int i = index; i < snapshots.num_snapshots - 1; i++) {
+    snapshots.snapshots[i] = snapshots.snapshots[i + 1];
+  }
+  snapshots.num_snapshots--;
+
+  if (snapshots.num_snapshots == 0) {
+    // the last snapshot is gone, so the table is not needed any more
+    block_num_t table_block = sb.snapshot_block;
+    sb.snapshot_block = 0;
+    if (write_superblock() < 0 || release_block(table_block) < 0) {
+      return -1;
+    }
+  } else if (write_snapshot_table() < 0) {
+    return -1;
+  }
+  if (release_block(bitmap_block) < 0) {
+    return -1;
+  }
+
+  // blocks kept only by this snapshot are free again
+  if (rebuild_frozen() < 0) {
+    return -1;
+  }
+  return recount_free_blocks();
+}
+
+
+block_num_t bfs_free_blocks() {
+  return sb.free_blocks;
+}
+
+
+block_num_t bfs_num_blocks() {
+  return sb.num_blocks;
+}
+
+
 int bfs_unmount() {
+  sb.state = FS_CLEAN;
+  if (write_superblock() < 0) {
+    return -1;
+  }
   return raw_unmount();
 }
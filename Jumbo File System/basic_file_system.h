@@ -3,6 +3,77 @@
 
 #include "raw_disk.h"
 
+// block numbers of the fixed metadata blocks
+#define BITMAP_BLOCK 0      // free-block bitmap, one bit per block (1 = allocated)
+#define ROOT_BLOCK 1        // root directory block of a freshly formatted image
+#define SUPERBLOCK_BLOCK 2  // struct superblock
+
+// identifies a formatted DISK image ("JFS1")
+#define JFS_MAGIC 0x3153464A
+// 2: small files stored inline in the inode, 3: snapshots, 4: data blocks
+// shared by dedup (a block with a reference count must not be freed by an
+// older version that does not know about them), 5: compressed files (an
+// older version would return their compressed bytes as the contents)
+#define JFS_VERSION 5
+
+// values of superblock.state
+#define FS_CLEAN 0 // the image was unmounted cleanly
+#define FS_DIRTY 1 // the image is mounted (or was not unmounted cleanly)
+
+// values of superblock.features (bit flags)
+#define FEATURE_DEDUP 0x1    // identical full data blocks are shared (see bfs_share_block())
+#define FEATURE_COMPRESS 0x2 // new files are compressed (used by the jumbo file system)
+
+// number of blocks in the reference count table (one byte per block)
+#define REFCOUNT_BLOCKS (NUM_BLOCKS / BLOCK_SIZE)
+
+// largest number of extra references a block can have
+#define MAX_REFCOUNT 255
+
+// This is the data stored in the superblock
+struct superblock {
+  uint32_t magic;        // JFS_MAGIC
+  uint16_t version;      // JFS_VERSION
+  uint16_t state;        // FS_CLEAN or FS_DIRTY
+  uint16_t num_blocks;   // NUM_BLOCKS the image was formatted with
+  uint16_t free_blocks;  // number of unallocated blocks (recounted if FS_DIRTY at mount)
+  block_num_t root_block;     // root directory of the live tree
+  block_num_t snapshot_block; // struct snapshot_table, or 0 if there are no snapshots
+  uint16_t features;          // FEATURE_* flags
+  block_num_t refcount_blocks[REFCOUNT_BLOCKS]; // reference count table, or all 0 if none
+};
+
+// maximum number of characters in a snapshot name (not counting '\0')
+#define SNAPSHOT_NAME_LENGTH 7
+
+// maximum number of snapshots that can exist at once
+#define MAX_SNAPSHOTS ((BLOCK_SIZE - sizeof(uint16_t)) / (SNAPSHOT_NAME_LENGTH + 1 + 2 * sizeof(block_num_t)))
+
+// This is the data stored in the snapshot table block.  A snapshot is a
+// saved root block plus a copy of the bitmap (without metadata blocks) taken
+// when the snapshot was created.  Blocks set in any snapshot's bitmap are
+// "frozen": they are never allocated, and are kept when the live tree
+// releases them, until the snapshot is deleted.
+struct snapshot_table {
+  uint16_t num_snapshots;
+  struct {
+    char name[SNAPSHOT_NAME_LENGTH + 1]; // +1 for the '\0' character
+    block_num_t root_block;   // root directory when the snapshot was taken
+    block_num_t bitmap_block; // the blocks in use when the snapshot was taken
+  } snapshots[MAX_SNAPSHOTS];
+};
+
+/* bfs_mount
+ *   mounts the raw disk and reads the superblock; if the image is fresh (its
+ *   bitmap and superblock are all zeros), a new bitmap and superblock are
+ *   written and the metadata blocks are marked allocated.  Any other image
+ *   without a valid magic number is not mounted, so it is never formatted
+ *   over.  On failure the raw disk is left unmounted.
+ * filename - the name of the DISK file on the _real_ file system
+ * returns 0 on success, 1 on success if the image was freshly formatted (the
+ *   caller must then initialize the root directory), or -1 on failure
+ *   (including an image written by an incompatible version)
+ */
 int bfs_mount(const char* filename);
 
 /* allocate_block
@@ -16,9 +87,27 @@ int bfs_mount(const char* filename);
  */
 block_num_t allocate_block();
 
+/* allocate_blocks
+ *   allocates count blocks at once, reading and writing the bitmap only once;
+ *   either all of the blocks are allocated or none are
+ * count - number of blocks to allocate
+ * blocks - array where the allocated block numbers will be written
+ * (precondition: blocks has room for count block numbers)
+ * returns 0 on success, or -1 on failure (failure may be assumed to mean that
+ *  there are fewer than count free blocks)
+ */
+int allocate_blocks(block_num_t count, block_num_t* blocks);
+
+/* bfs_num_allocations
+ *   returns the number of blocks allocated since the file system was mounted
+ *   (a count that only goes up; used to measure operations)
+ */
+uint64_t bfs_num_allocations();
+
 /* release_block
  *   releases the specified disk block, allowing it to be allocated again by
- *   allocate_block() sometime in the future
+ *   allocate_block() sometime in the future; if the block has extra
+ *   references (see bfs_share_block()), one reference is dropped instead
  * block - number of the block to release
  * returns 0 on success and -1 on failure
  * (Failure of release_block() should only happen if there is an error
@@ -27,6 +116,134 @@ block_num_t allocate_block();
  */
 int release_block(block_num_t block);
 
+/* bfs_is_frozen
+ *   returns 1 if the block belongs to a snapshot, in which case its contents
+ *   must not be changed (write a copy to a newly allocated block instead), or
+ *   0 otherwise; this costs no disk I/O
+ */
+int bfs_is_frozen(block_num_t block);
+
+/* bfs_root
+ *   returns the block number of the root directory of the live tree
+ */
+block_num_t bfs_root();
+
+/* bfs_set_root
+ *   makes a different block the root directory of the live tree (used when
+ *   the root is copied because a snapshot shares it)
+ * returns 0 on success and -1 on failure
+ */
+int bfs_set_root(block_num_t block);
+
+/* bfs_snapshot
+ *   creates a snapshot of the live tree in O(1): the bitmap is copied to a
+ *   new block and the root is recorded, so every block currently in use
+ *   becomes frozen
+ * name - name of the new snapshot (at most SNAPSHOT_NAME_LENGTH characters)
+ * returns 0 on success and -1 on failure
+ * (precondition: no snapshot with this name exists, fewer than MAX_SNAPSHOTS
+ *  snapshots exist, and at least 2 blocks are free)
+ */
+int bfs_snapshot(const char* name);
+
+/* bfs_find_snapshot
+ *   returns the index of the named snapshot, or -1 if there is none
+ */
+int bfs_find_snapshot(const char* name);
+
+/* bfs_num_snapshots
+ *   returns the number of snapshots
+ */
+int bfs_num_snapshots();
+
+/* bfs_snapshot_name
+ *   returns the name of the snapshot with the given index
+ * (precondition: 0 <= index < bfs_num_snapshots())
+ */
+const char* bfs_snapshot_name(int index);
+
+/* bfs_rollback
+ *   makes the live tree the one saved in a snapshot; blocks used only by the
+ *   live tree are released, and the snapshot is kept
+ * index - index of the snapshot
+ * returns 0 on success and -1 on failure
+ */
+int bfs_rollback(int index);
+
+/* bfs_delete_snapshot
+ *   deletes a snapshot, releasing the blocks that only it was keeping
+ * index - index of the snapshot
+ * returns 0 on success and -1 on failure
+ */
+int bfs_delete_snapshot(int index);
+
+/* release_blocks
+ *   releases count blocks at once, like calling release_block() on each of
+ *   them but reading and writing the bitmap only once; a block may appear
+ *   more than once if it is shared (see bfs_share_block())
+ * count - number of blocks to release
+ * blocks - the block numbers
+ * returns 0 on success and -1 on failure
+ */
+int release_blocks(int count, const block_num_t* blocks);
+
+/* bfs_has_feature
+ *   returns 1 if the FEATURE_* flag is set in the superblock, or 0 otherwise
+ */
+int bfs_has_feature(uint16_t feature);
+
+/* bfs_set_feature
+ *   sets or clears a FEATURE_* flag; setting FEATURE_DEDUP creates the
+ *   reference count table if there is none yet (it is kept when the flag is
+ *   cleared, since blocks may still be shared)
+ * returns 0 on success, or -1 on failure (e.g. no room for the table)
+ */
+int bfs_set_feature(uint16_t feature, int enable);
+
+/* bfs_refcount
+ *   returns the number of extra references to a block (0 unless the block is
+ *   shared); this costs no disk I/O
+ */
+int bfs_refcount(block_num_t block);
+
+/* bfs_refcount_table
+ *   returns the first block of the reference count table, or 0 if the image
+ *   has none (dedup was never turned on)
+ */
+block_num_t bfs_refcount_table();
+
+/* bfs_share_block
+ *   adds a reference to an allocated block, so it takes one more
+ *   release_block() call to release it
+ * returns 0 on success, or -1 on failure (including no reference count
+ *  table, or MAX_REFCOUNT extra references already)
+ */
+int bfs_share_block(block_num_t block);
+
+/* bfs_set_refcounts
+ *   replaces the whole reference count table (e.g. after recounting the
+ *   references in the tree)
+ * refcounts - the number of extra references of each of the NUM_BLOCKS blocks
+ * returns 0 on success and -1 on failure
+ */
+int bfs_set_refcounts(const unsigned char* refcounts);
+
+/* bfs_free_blocks
+ *   returns the number of unallocated blocks; this is a counter maintained by
+ *   allocate_block() and release_block(), so it costs no disk I/O
+ */
+block_num_t bfs_free_blocks();
+
+/* bfs_num_blocks
+ *   returns the total number of blocks on the disk
+ */
+block_num_t bfs_num_blocks();
+
+/* bfs_unmount
+ *   writes the superblock (including the free-block count) marked clean and
+ *   unmounts the raw disk
+ * returns 0 on success and -1 on failure
+ */
 int bfs_unmount();
 
 #endif // _BASIC_FILE_SYSTEM_H_
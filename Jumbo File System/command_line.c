@@ -6,7 +6,8 @@
 
 #define DISK_FILENAME "DISK"
 #define MAX_CMD_LENGTH 2048
-#define MAX_ARGS 2
+#define MAX_ARGS 64
+#define BATCH_BUFFER_SIZE (64 * 1024) // stdout buffer in batch mode
 #define WHITESPACE_DELIM " \t\r\n"
 
 
@@ -39,7 +40,13 @@ void print_error(int err, const char* name) {
       printf("file is full (max file size reached)\n");
       break;
     case E_DISK_FULL:
-      printf("disk is full");
+      printf("disk is full\n");
+      break;
+    case E_MAX_SNAPSHOTS:
+      printf("too many snapshots (max snapshots reached)\n");
+      break;
+    case E_INVALID:
+      printf("cannot move %s into itself\n", name);
       break;
     case E_UNKNOWN:
       printf("an unknown error occurred\n");
@@ -50,6 +57,14 @@ void print_error(int err, const char* name) {
 }
 
 
+// jfs_visitor_t for the find command
+int print_path(const char* path, const struct stats* st, void* arg) {
+  (void) arg;
+  printf("%s%s\n", path, st->is_dir ? "" : "/");
+  return 0;
+}
+
+
 /* run_command
  *   Runs one entire command line, which may include multiple pipeline stages
  */
@@ -82,20 +97,24 @@ void run_command(char* command_line) {
     print_error(ret, tokens[1]);
 
   } else if (0 == strcmp(tokens[0], "mkdir")) {
-    if (NULL == tokens[1] || NULL != tokens[2]) {
-      fprintf(stderr, "usage: mkdir <dir_name>\n");
+    if (NULL == tokens[1]) {
+      fprintf(stderr, "usage: mkdir <dir_name> [dir_name ...]\n");
       return;
     }
-    int ret = jfs_mkdir(tokens[1]);
-    print_error(ret, tokens[1]);
+    for (int i = 1; NULL != tokens[i]; i++) {
+      int ret = jfs_mkdir(tokens[i]);
+      print_error(ret, tokens[i]);
+    }
 
   } else if (0 == strcmp(tokens[0], "rmdir")) {
-    if (NULL == tokens[1] || NULL != tokens[2]) {
-      fprintf(stderr, "usage: rmdir <dir_name>\n");
+    if (NULL == tokens[1]) {
+      fprintf(stderr, "usage: rmdir <dir_name> [dir_name ...]\n");
       return;
     }
-    int ret = jfs_rmdir(tokens[1]);
-    print_error(ret, tokens[1]);
+    for (int i = 1; NULL != tokens[i]; i++) {
+      int ret = jfs_rmdir(tokens[i]);
+      print_error(ret, tokens[i]);
+    }
 
   } else if (0 == strcmp(tokens[0], "ls")) {
     if (NULL != tokens[1]) {
@@ -103,89 +122,105 @@ void run_command(char* command_line) {
       return;
     }
 
-    char* directories[MAX_DIR_ENTRIES];
-    char* files[MAX_DIR_ENTRIES];
-    memset(directories, -1, MAX_DIR_ENTRIES * sizeof(const char*));
-    memset(files,       -1, MAX_DIR_ENTRIES * sizeof(const char*));
-    int ret = jfs_ls(directories, files);
+    char names[LS_PACKED_SIZE];
+    int num_directories, num_files;
+    int ret = jfs_ls_packed(names, &num_directories, &num_files);
 
     if (E_SUCCESS == ret) {
-      for (int i = 0; NULL != directories[i]; i++) {
-        printf("%s/\n", directories[i]);
-        free(directories[i]);
-      }
-      for (int i = 0; NULL != files[i]; i++) {
-        printf("%s\n", files[i]);
-        free(files[i]);
+      const char* name = names;
+      for (int i = 0; i < num_directories + num_files; i++) {
+        printf(i < num_directories ? "%s/\n" : "%s\n", name);
+        name += strlen(name) + 1;
       }
     } else {
       printf("ls failed - but ls should never fail!\n");
     }
 
   } else if (0 == strcmp(tokens[0], "touch")) {
-    if (NULL == tokens[1] || NULL != tokens[2]) {
-      fprintf(stderr, "usage: touch <file_name>\n");
+    if (NULL == tokens[1]) {
+      fprintf(stderr, "usage: touch <file_name> [file_name ...]\n");
       return;
     }
-    int ret = jfs_creat(tokens[1]);
-    print_error(ret, tokens[1]);
+    for (int i = 1; NULL != tokens[i]; i++) {
+      int ret = jfs_creat(tokens[i]);
+      print_error(ret, tokens[i]);
+    }
 
   } else if (0 == strcmp(tokens[0], "rm")) {
-    if (NULL == tokens[1] || NULL != tokens[2]) {
-      fprintf(stderr, "usage: rm <file_name>\n");
+    // rm -r removes directories and everything in them too
+    int recursive = NULL != tokens[1] && 0 == strcmp(tokens[1], "-r");
+    int first = recursive ? 2 : 1;
+    if (NULL == tokens[first]) {
+      fprintf(stderr, "usage: rm [-r] <file_name> [file_name ...]\n");
+      return;
+    }
+    for (int i = first; NULL != tokens[i]; i++) {
+      int ret = recursive ? jfs_remove_tree(tokens[i]) : jfs_remove(tokens[i]);
+      print_error(ret, tokens[i]);
+    }
+
+  } else if (0 == strcmp(tokens[0], "mv")) {
+    if (NULL == tokens[1] || NULL == tokens[2] || NULL != tokens[3]) {
+      fprintf(stderr, "usage: mv <old_path> <new_path>\n(paths are relative to the current directory, or start with /)\n");
       return;
     }
-    int ret = jfs_remove(tokens[1]);
+    int ret = jfs_rename(tokens[1], tokens[2]);
     print_error(ret, tokens[1]);
 
   } else if (0 == strcmp(tokens[0], "stat")) {
-    if (NULL == tokens[1] || NULL != tokens[2]) {
-      fprintf(stderr, "usage: stat <file_name>\n");
+    if (NULL == tokens[1]) {
+      fprintf(stderr, "usage: stat <file_name> [file_name ...]\n");
       return;
     }
 
-    struct stats file_stats;
-    memset(&file_stats, -1, sizeof(file_stats));
-    int ret = jfs_stat(tokens[1], &file_stats);
-
-    if (E_SUCCESS == ret) {
-      if (!file_stats.is_dir) {
-        printf("Directory name: %s\n", file_stats.name);
-        printf("Directory block number: %u\n", file_stats.block_num);
+    for (int i = 1; NULL != tokens[i]; i++) {
+      struct stats file_stats;
+      memset(&file_stats, -1, sizeof(file_stats));
+      int ret = jfs_stat(tokens[i], &file_stats);
+
+      if (E_SUCCESS == ret) {
+        if (!file_stats.is_dir) {
+          printf("Directory name: %s\n", file_stats.name);
+          printf("Directory block number: %u\n", file_stats.block_num);
+        } else {
+          // is regular file
+          printf("File name: %s\n", file_stats.name);
+          printf("Inode block number: %u\n", file_stats.block_num);
+          printf("Number of data blocks: %u\n", file_stats.num_data_blocks);
+          printf("File size: %u\n", file_stats.file_size);
+          printf("Physical size: %u\n", file_stats.physical_size);
+        }
       } else {
-        // is regular file
-        printf("File name: %s\n", file_stats.name);
-        printf("Inode block number: %u\n", file_stats.block_num);
-        printf("Number of data blocks: %u\n", file_stats.num_data_blocks);
-        printf("File size: %u\n", file_stats.file_size);
+        print_error(ret, tokens[i]);
       }
-    } else {
-      print_error(ret, tokens[1]);
     }
 
   } else if (0 == strcmp(tokens[0], "cat")) {
-    if (NULL == tokens[1] || NULL != tokens[2]) {
-      fprintf(stderr, "usage: cat <file_name>\n");
+    if (NULL == tokens[1]) {
+      fprintf(stderr, "usage: cat <file_name> [file_name ...]\n");
       return;
     }
 
-    unsigned short bytes_read = MAX_FILE_SIZE;
-    char file_data[MAX_FILE_SIZE];
-    memset(file_data, -1, MAX_FILE_SIZE);
-    int ret = jfs_read(tokens[1], file_data, &bytes_read);
-
-    if (E_SUCCESS == ret) {
-      ret = write(STDOUT_FILENO, file_data, bytes_read);
-      printf("\n");
-      if (ret != bytes_read) {
-        perror("Failed to write file data to stdout");
+    for (int i = 1; NULL != tokens[i]; i++) {
+      unsigned short bytes_read = MAX_FILE_SIZE;
+      char file_data[MAX_FILE_SIZE];
+      memset(file_data, -1, MAX_FILE_SIZE);
+      int ret = jfs_read(tokens[i], file_data, &bytes_read);
+
+      if (E_SUCCESS == ret) {
+        // goes through stdout's buffer so output stays in order in batch mode
+        size_t written = fwrite(file_data, 1, bytes_read, stdout);
+        printf("\n");
+        if (written != bytes_read) {
+          perror("Failed to write file data to stdout");
+        }
+      } else {
+        print_error(ret, tokens[i]);
       }
-    } else {
-      print_error(ret, tokens[1]);
     }
 
   } else if (0 == strcmp(tokens[0], "append")) {
-    if (NULL == tokens[1] || NULL == tokens[2]) {
+    if (NULL == tokens[1] || NULL == tokens[2] || NULL != tokens[3]) {
       fprintf(stderr, "usage: append <file_name> <data>\n");
       return;
     }
@@ -193,6 +228,143 @@ void run_command(char* command_line) {
     int ret = jfs_write(tokens[1], tokens[2], strlen(tokens[2]));
     print_error(ret, tokens[1]);
 
+  } else if (0 == strcmp(tokens[0], "du")) {
+    // no names: the current directory
+    for (int i = 1; i == 1 || NULL != tokens[i]; i++) {
+      struct du_stats usage;
+      int ret = jfs_du(tokens[i], &usage);
+      if (E_SUCCESS == ret) {
+        printf("%u blocks\t%u bytes in %u files, %u directories\t%s\n",
+               usage.num_blocks, usage.file_bytes, usage.num_files, usage.num_dirs,
+               NULL == tokens[i] ? "." : tokens[i]);
+      } else {
+        print_error(ret, tokens[i]);
+      }
+    }
+
+  } else if (0 == strcmp(tokens[0], "find")) {
+    if (NULL != tokens[1]) {
+      fprintf(stderr, "usage: find\n");
+      return;
+    }
+    jfs_walk(print_path, NULL);
+
+  } else if (0 == strcmp(tokens[0], "truncate")) {
+    if (NULL == tokens[1] || NULL == tokens[2] || NULL != tokens[3]) {
+      fprintf(stderr, "usage: truncate <file_name> <size>\n");
+      return;
+    }
+    int ret = jfs_truncate(tokens[1], atoi(tokens[2]));
+    print_error(ret, tokens[1]);
+
+  } else if (0 == strcmp(tokens[0], "punch")) {
+    if (NULL == tokens[1] || NULL == tokens[2] || NULL == tokens[3] || NULL != tokens[4]) {
+      fprintf(stderr, "usage: punch <file_name> <offset> <length>\n");
+      return;
+    }
+    int ret = jfs_punch_hole(tokens[1], atoi(tokens[2]), atoi(tokens[3]));
+    print_error(ret, tokens[1]);
+
+  } else if (0 == strcmp(tokens[0], "df")) {
+    if (NULL != tokens[1]) {
+      fprintf(stderr, "usage: df\n");
+      return;
+    }
+
+    struct fs_stats fs;
+    jfs_statfs(&fs);
+    printf("Block size: %u\n", fs.block_size);
+    printf("Total blocks: %u\n", fs.num_blocks);
+    printf("Free blocks: %u\n", fs.free_blocks);
+
+  } else if (0 == strcmp(tokens[0], "snapshot")) {
+    if (NULL == tokens[1]) {
+      // no name: list the snapshots
+      char* names[MAX_SNAPSHOTS + 1];
+      jfs_list_snapshots(names);
+      for (int i = 0; NULL != names[i]; i++) {
+        printf("%s\n", names[i]);
+        free(names[i]);
+      }
+      return;
+    }
+    if (NULL != tokens[2]) {
+      fprintf(stderr, "usage: snapshot [snapshot_name]\n(leaving out snapshot_name lists the snapshots)\n");
+      return;
+    }
+    int ret = jfs_snapshot(tokens[1]);
+    print_error(ret, tokens[1]);
+
+  } else if (0 == strcmp(tokens[0], "rollback")) {
+    if (NULL == tokens[1] || NULL != tokens[2]) {
+      fprintf(stderr, "usage: rollback <snapshot_name>\n");
+      return;
+    }
+    int ret = jfs_rollback(tokens[1]);
+    print_error(ret, tokens[1]);
+
+  } else if (0 == strcmp(tokens[0], "rmsnap")) {
+    if (NULL == tokens[1]) {
+      fprintf(stderr, "usage: rmsnap <snapshot_name> [snapshot_name ...]\n");
+      return;
+    }
+    for (int i = 1; NULL != tokens[i]; i++) {
+      int ret = jfs_delete_snapshot(tokens[i]);
+      print_error(ret, tokens[i]);
+    }
+
+  } else if (0 == strcmp(tokens[0], "dedup")) {
+    int enable = NULL != tokens[1] && 0 == strcmp(tokens[1], "on");
+    if (NULL == tokens[1] || NULL != tokens[2] ||
+        (!enable && 0 != strcmp(tokens[1], "off"))) {
+      fprintf(stderr, "usage: dedup <on|off>\n");
+      return;
+    }
+    int ret = jfs_set_dedup(enable);
+    print_error(ret, tokens[0]);
+
+  } else if (0 == strcmp(tokens[0], "compress")) {
+    int enable = NULL != tokens[1] && 0 == strcmp(tokens[1], "on");
+    if (NULL == tokens[1] || NULL != tokens[2] ||
+        (!enable && 0 != strcmp(tokens[1], "off"))) {
+      fprintf(stderr, "usage: compress <on|off>\n(only affects files created afterwards)\n");
+      return;
+    }
+    int ret = jfs_set_compression(enable);
+    print_error(ret, tokens[0]);
+
+  } else if (0 == strcmp(tokens[0], "checksums")) {
+    int enable = NULL != tokens[1] && 0 == strcmp(tokens[1], "on");
+    if (NULL == tokens[1] || NULL != tokens[2] ||
+        (!enable && 0 != strcmp(tokens[1], "off"))) {
+      fprintf(stderr, "usage: checksums <on|off>\n");
+      return;
+    }
+    int ret = jfs_set_checksums(enable);
+    print_error(ret, tokens[0]);
+
+  } else if (0 == strcmp(tokens[0], "prefetch")) {
+    int enable = NULL != tokens[1] && 0 == strcmp(tokens[1], "on");
+    if (NULL == tokens[1] || NULL != tokens[2] ||
+        (!enable && 0 != strcmp(tokens[1], "off"))) {
+      fprintf(stderr, "usage: prefetch <on|off>\n(cd then reads the entries of the new directory in the background)\n");
+      return;
+    }
+    int ret = jfs_set_prefetch(enable);
+    print_error(ret, tokens[0]);
+
+  } else if (0 == strcmp(tokens[0], "stats")) {
+    if (NULL != tokens[1] && (NULL != tokens[2] ||
+        (0 != strcmp(tokens[1], "json") && 0 != strcmp(tokens[1], "reset")))) {
+      fprintf(stderr, "usage: stats [json|reset]\n(per-operation calls, block I/O and latency since mount or the last reset)\n");
+      return;
+    }
+    if (NULL != tokens[1] && 0 == strcmp(tokens[1], "reset")) {
+      jfs_reset_stats();
+    } else {
+      jfs_print_stats(stdout, NULL != tokens[1]);
+    }
+
   } else {
     fprintf(stderr, "ERROR: unrecognized command\n");
   }
@@ -229,8 +401,86 @@ void prompt_for_input(char* input_buffer, int buflen) {
 }
 
 
-int main() {
+/* is_exit
+ *   Checks whether a line of input is the exit command
+ */
+int is_exit(const char* input_buffer) {
+  return 0 == strncmp(input_buffer, "exit", 4) &&
+         ('\0' == input_buffer[4] || '\n' == input_buffer[4]);
+}
+
+
+/* run_script
+ *   Runs each line of a script as a command, without prompting, until the end
+ *   of the input or an exit command; lines starting with '#' are comments
+ */
+void run_script(FILE* input) {
   char input_buffer[MAX_CMD_LENGTH];
+  int line_num = 0;
+
+  while (NULL != fgets(input_buffer, MAX_CMD_LENGTH, input)) {
+    line_num++;
+    size_t len = strlen(input_buffer);
+    if (input_buffer[len-1] != '\n' && !feof(input)) {
+      fprintf(stderr, "ERROR: line %d exceeds maximum command line length\n", line_num);
+      int c;
+      while ('\n' != (c = getc(input)) && EOF != c) {} /* consume rest of line */
+      continue;
+    }
+    if (is_exit(input_buffer)) {
+      break;
+    }
+    if ('#' != input_buffer[0]) {
+      run_command(input_buffer); /* may alter input_buffer!! */
+    }
+  }
+}
+
+
+void usage(const char* name) {
+  fprintf(stderr, "usage: %s [-b] [-s stats_file] [-t trace_file] [script_file]\n", name);
+  fprintf(stderr, "  -b  batch mode: run commands from stdin without prompting\n");
+  fprintf(stderr, "  -s  write the per-operation stats to stats_file as JSON on exit\n");
+  fprintf(stderr, "  -t  record every file system call to trace_file, for jfs_replay\n");
+  fprintf(stderr, "  script_file  run the commands in the file in batch mode\n");
+}
+
+
+int main(int argc, char* argv[]) {
+  char input_buffer[MAX_CMD_LENGTH];
+  int batch = 0; // FALSE
+  FILE* script = stdin;
+  const char* stats_filename = NULL;
+  const char* trace_filename = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "bs:t:")) != -1) {
+    if ('b' == opt) {
+      batch = 1;
+    } else if ('s' == opt) {
+      stats_filename = optarg;
+    } else if ('t' == opt) {
+      trace_filename = optarg;
+    } else {
+      usage(argv[0]);
+      exit(1);
+    }
+  }
+  if (optind < argc - 1) {
+    usage(argv[0]);
+    exit(1);
+  } else if (optind == argc - 1) {
+    script = fopen(argv[optind], "r");
+    if (NULL == script) {
+      perror(argv[optind]);
+      exit(1);
+    }
+    batch = 1;
+  }
+  if (batch) {
+    // no prompts, and output is flushed in large chunks instead of per line
+    setvbuf(stdout, NULL, _IOFBF, BATCH_BUFFER_SIZE);
+  }
 
   /*
   printf("File system parameters:\n");
@@ -243,14 +493,30 @@ int main() {
   printf("sizeof block struct = %ld\n\n", sizeof(struct block));
   */
 
-  jfs_mount(DISK_FILENAME);
+  if (jfs_mount(DISK_FILENAME) < 0) {
+    fprintf(stderr, "FATAL ERROR: could not mount %s\n", DISK_FILENAME);
+    exit(1);
+  }
+  jfs_set_stats_file(stats_filename);
+  if (NULL != trace_filename && jfs_set_trace_file(trace_filename) != E_SUCCESS) {
+    fprintf(stderr, "FATAL ERROR: could not record a trace to %s\n", trace_filename);
+    jfs_unmount();
+    exit(1);
+  }
 
-  prompt_for_input(input_buffer, MAX_CMD_LENGTH);
-  while (0 != strcmp(input_buffer, "exit\n")) {
-    run_command(input_buffer); /* may alter input_buffer!! */
+  if (batch) {
+    run_script(script);
+  } else {
     prompt_for_input(input_buffer, MAX_CMD_LENGTH);
+    while (0 != strcmp(input_buffer, "exit\n")) {
+      run_command(input_buffer); /* may alter input_buffer!! */
+      prompt_for_input(input_buffer, MAX_CMD_LENGTH);
+    }
   }
 
   jfs_unmount();
+  if (stdin != script) {
+    fclose(script);
+  }
   return 0;
 }
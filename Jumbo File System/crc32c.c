@@ -0,0 +1,89 @@
+#include "crc32c.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_SSE42_PATH 1
+#endif
+
+#define POLY 0x82f63b78 // CRC-32C, reversed
+
+// table[k][b]: the CRC of byte b followed by k zero bytes (slicing-by-8)
+static uint32_t table[8][256];
+
+static uint32_t crc32c_resolve(const void* buf, size_t len);
+static uint32_t (*crc32c_impl)(const void*, size_t) = crc32c_resolve;
+
+
+static uint32_t crc32c_table(const void* buf, size_t len) {
+  const unsigned char* p = buf;
+  uint32_t crc = 0xffffffff;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    word ^= crc; // little-endian
+    crc = table[7][word & 0xff] ^ table[6][(word >> 8) & 0xff] ^
+          table[5][(word >> 16) & 0xff] ^ table[4][(word >> 24) & 0xff] ^
+          table[3][(word >> 32) & 0xff] ^ table[2][(word >> 40) & 0xff] ^
+          table[1][(word >> 48) & 0xff] ^ table[0][word >> 56];
+    p += 8;
+    len -= 8;
+  }
+  while (len-- > 0) {
+    crc = table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+
+#ifdef HAVE_SSE42_PATH
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(const void* buf, size_t len) {
+  const unsigned char* p = buf;
+  uint32_t crc = 0xffffffff;
+#ifdef __x86_64__
+  uint64_t crc64 = crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+    p += 8;
+    len -= 8;
+  }
+  crc = crc64;
+#endif
+  while (len-- > 0) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+  return ~crc;
+}
+#endif
+
+
+// picks an implementation on the first call
+static uint32_t crc32c_resolve(const void* buf, size_t len) {
+  for (int b = 0; b < 256; b++) {
+    uint32_t crc = b;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc >> 1) ^ (crc & 1 ? POLY : 0);
+    }
+    table[0][b] = crc;
+  }
+  for (int b = 0; b < 256; b++) {
+    for (int k = 1; k < 8; k++) {
+      table[k][b] = table[0][table[k - 1][b] & 0xff] ^ (table[k - 1][b] >> 8);
+    }
+  }
+  crc32c_impl = crc32c_table;
+#ifdef HAVE_SSE42_PATH
+  if (__builtin_cpu_supports("sse4.2")) {
+    crc32c_impl = crc32c_sse42;
+  }
+#endif
+  return crc32c_impl(buf, len);
+}
+
+
+uint32_t crc32c(const void* buf, size_t len) {
+  return crc32c_impl(buf, len);
+}
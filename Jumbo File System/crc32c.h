@@ -0,0 +1,13 @@
+#ifndef _CRC32C_H_
+#define _CRC32C_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* crc32c
+ *   computes the CRC-32C (Castagnoli) checksum of a buffer, with the SSE4.2
+ *   crc32 instruction when the CPU has it and eight lookup tables otherwise
+ */
+uint32_t crc32c(const void* buf, size_t len);
+
+#endif // _CRC32C_H_
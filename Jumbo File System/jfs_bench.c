@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "jumbo_file_system.h"
+
+#define BENCH_FILENAME "BENCH_DISK"
+#define DEFAULT_OPS 10000
+#define DEFAULT_DEPTH 32
+#define DEFAULT_CHUNK 16
+
+static int depth = DEFAULT_DEPTH;         // directories in a chdir walk
+static unsigned short chunk = DEFAULT_CHUNK; // bytes per append
+static int read_threads = 1;                 // threads per jfs_read()
+static char data[MAX_FILE_SIZE];
+
+
+/* Each workload has an untimed setup step, an optional untimed step run
+ * before every operation, and the timed operation itself.  Operations return
+ * a jfs error code; anything other than E_SUCCESS stops the benchmark.
+ */
+struct workload {
+  const char* name;
+  const char* description;
+  int (*setup)();
+  int (*before_op)(int i);
+  int (*op)(int i);
+};
+
+
+/* create: fill the root directory with files, then remove them all */
+static int create_op(int i) {
+  char name[MAX_NAME_LENGTH + 1];
+  int phase = i % (2 * MAX_DIR_ENTRIES);
+  if (phase < (int) MAX_DIR_ENTRIES) {
+    snprintf(name, sizeof(name), "f%d", phase);
+    return jfs_creat(name);
+  }
+  snprintf(name, sizeof(name), "f%d", phase - (int) MAX_DIR_ENTRIES);
+  return jfs_remove(name);
+}
+
+
+/* append: append chunks to one file, starting over when it is full */
+static uint32_t stream_size;
+
+static int append_setup() {
+  stream_size = 0;
+  return jfs_creat("stream");
+}
+
+static int append_before_op(int i) {
+  (void) i;
+  if (stream_size + chunk <= MAX_FILE_SIZE) {
+    return E_SUCCESS;
+  }
+  int ret = jfs_remove("stream");
+  if (ret == E_SUCCESS) {
+    ret = jfs_creat("stream");
+  }
+  stream_size = 0;
+  return ret;
+}
+
+static int append_op(int i) {
+  (void) i;
+  stream_size += chunk;
+  return jfs_write("stream", data, chunk);
+}
+
+
+/* read: read a file of MAX_FILE_SIZE bytes in full */
+static int read_setup() {
+  int ret = jfs_creat("big");
+  if (ret == E_SUCCESS) {
+    ret = jfs_write("big", data, MAX_FILE_SIZE);
+  }
+  return ret;
+}
+
+static int read_op(int i) {
+  (void) i;
+  char buf[MAX_FILE_SIZE];
+  unsigned short count = MAX_FILE_SIZE;
+  int ret = jfs_read("big", buf, &count);
+  if (ret == E_SUCCESS && count != MAX_FILE_SIZE) {
+    ret = E_UNKNOWN;
+  }
+  return ret;
+}
+
+
+/* ls: list a full directory holding both subdirectories and files */
+static int ls_setup() {
+  char name[MAX_NAME_LENGTH + 1];
+  for (int i = 0; i < (int) MAX_DIR_ENTRIES; i++) {
+    snprintf(name, sizeof(name), "e%d", i);
+    int ret = i % 2 ? jfs_creat(name) : jfs_mkdir(name);
+    if (ret != E_SUCCESS) {
+      return ret;
+    }
+  }
+  return E_SUCCESS;
+}
+
+static int ls_op(int i) {
+  (void) i;
+  char* directories[MAX_DIR_ENTRIES + 1];
+  char* files[MAX_DIR_ENTRIES + 1];
+  int ret = jfs_ls(directories, files);
+  if (ret == E_SUCCESS) {
+    for (int j = 0; directories[j] != NULL; j++) {
+      free(directories[j]);
+    }
+    for (int j = 0; files[j] != NULL; j++) {
+      free(files[j]);
+    }
+  }
+  return ret;
+}
+
+static int ls_packed_op(int i) {
+  (void) i;
+  char names[LS_PACKED_SIZE];
+  int num_directories, num_files;
+  return jfs_ls_packed(names, &num_directories, &num_files);
+}
+
+
+/* chdir: walk from the root down a chain of nested directories */
+static int chdir_setup() {
+  for (int i = 0; i < depth; i++) {
+    int ret = jfs_mkdir("d");
+    if (ret == E_SUCCESS) {
+      ret = jfs_chdir("d");
+    }
+    if (ret != E_SUCCESS) {
+      return ret;
+    }
+  }
+  return jfs_chdir(NULL);
+}
+
+static int chdir_op(int i) {
+  (void) i;
+  int ret = jfs_chdir(NULL);
+  for (int j = 0; j < depth && ret == E_SUCCESS; j++) {
+    ret = jfs_chdir("d");
+  }
+  return ret;
+}
+
+
+static struct workload workloads[] = {
+  {"create", "creat/remove storm in one directory", NULL, NULL, create_op},
+  {"append", "append stream to one file", append_setup, append_before_op, append_op},
+  {"read", "full-file reads of a maximum size file", read_setup, NULL, read_op},
+  {"ls", "ls of a full directory", ls_setup, NULL, ls_op},
+  {"lspacked", "ls of a full directory into one buffer", ls_setup, NULL, ls_packed_op},
+  {"chdir", "walk from the root down nested directories", chdir_setup, NULL, chdir_op},
+};
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*) a;
+  uint64_t y = *(const uint64_t*) b;
+  return (x > y) - (x < y);
+}
+
+
+/* run_workload
+ *   runs num_ops operations of a workload against a freshly formatted image
+ *   and prints one line of results
+ * returns 0 on success or -1 on failure
+ */
+static int run_workload(const struct workload* w, const char* filename, int num_ops) {
+  unlink(filename);
+  if (jfs_mount(filename) < 0) {
+    fprintf(stderr, "%s: could not mount %s\n", w->name, filename);
+    return -1;
+  }
+  if (jfs_set_read_threads(read_threads) != E_SUCCESS) {
+    fprintf(stderr, "%s: could not start %d read threads\n", w->name, read_threads);
+    jfs_unmount();
+    return -1;
+  }
+
+  int ret = w->setup ? w->setup() : E_SUCCESS;
+  if (ret != E_SUCCESS) {
+    fprintf(stderr, "%s: setup failed (%d)\n", w->name, ret);
+    jfs_unmount();
+    return -1;
+  }
+
+  uint64_t* latencies = malloc(num_ops * sizeof(uint64_t));
+  struct raw_stats total = {0, 0, 0, 0, 0};
+  uint64_t elapsed = 0;
+
+  for (int i = 0; i < num_ops; i++) {
+    ret = w->before_op ? w->before_op(i) : E_SUCCESS;
+    if (ret != E_SUCCESS) {
+      break;
+    }
+
+    struct raw_stats stats;
+    raw_reset_stats();
+    uint64_t start = now_ns();
+    ret = w->op(i);
+    latencies[i] = now_ns() - start;
+    raw_get_stats(&stats);
+    if (ret != E_SUCCESS) {
+      break;
+    }
+
+    elapsed += latencies[i];
+    total.block_reads += stats.block_reads;
+    total.block_writes += stats.block_writes;
+    total.syscalls += stats.syscalls;
+  }
+  jfs_unmount();
+  if (ret != E_SUCCESS) {
+    fprintf(stderr, "%s: operation failed (%d)\n", w->name, ret);
+    free(latencies);
+    return -1;
+  }
+
+  qsort(latencies, num_ops, sizeof(uint64_t), compare_u64);
+  printf("%-8s %8d %12.0f %9.2f %9.2f %9.2f %9.2f %11.2f\n",
+         w->name, num_ops,
+         num_ops / (elapsed / 1e9),
+         latencies[num_ops / 2] / 1e3,
+         latencies[(num_ops * 99) / 100] / 1e3,
+         (double) total.block_reads / num_ops,
+         (double) total.block_writes / num_ops,
+         (double) total.syscalls / num_ops);
+  free(latencies);
+  return 0;
+}
+
+
+void usage(const char* name) {
+  fprintf(stderr, "usage: %s [-n ops] [-d depth] [-c chunk] [-j threads] [-f image] [workload ...]\n", name);
+  fprintf(stderr, "  -n  operations per workload (default %d)\n", DEFAULT_OPS);
+  fprintf(stderr, "  -d  directories per chdir walk (default %d)\n", DEFAULT_DEPTH);
+  fprintf(stderr, "  -c  bytes per append (default %d)\n", DEFAULT_CHUNK);
+  fprintf(stderr, "  -j  threads per jfs_read() (default 1, at most %d)\n", MAX_READ_THREADS);
+  fprintf(stderr, "  -f  scratch image, overwritten (default %s)\n", BENCH_FILENAME);
+  fprintf(stderr, "workloads (default all):\n");
+  for (size_t i = 0; i < NUM_WORKLOADS; i++) {
+    fprintf(stderr, "  %-8s %s\n", workloads[i].name, workloads[i].description);
+  }
+}
+
+
+int main(int argc, char* argv[]) {
+  int num_ops = DEFAULT_OPS;
+  const char* filename = BENCH_FILENAME;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:d:c:j:f:")) != -1) {
+    switch (opt) {
+    case 'n':
+      num_ops = atoi(optarg);
+      break;
+    case 'd':
+      depth = atoi(optarg);
+      break;
+    case 'c':
+      chunk = atoi(optarg);
+      break;
+    case 'j':
+      read_threads = atoi(optarg);
+      break;
+    case 'f':
+      filename = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (num_ops < 1 || depth < 1 || chunk < 1 || chunk > MAX_FILE_SIZE ||
+      read_threads < 1 || read_threads > MAX_READ_THREADS) {
+    usage(argv[0]);
+    return 1;
+  }
+  for (int i = optind; i < argc; i++) {
+    size_t w;
+    for (w = 0; w < NUM_WORKLOADS && strcmp(argv[i], workloads[w].name) != 0; w++) {}
+    if (w == NUM_WORKLOADS) {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  memset(data, 'x', sizeof(data));
+  printf("%-8s %8s %12s %9s %9s %9s %9s %11s\n",
+         "workload", "ops", "ops/s", "p50(us)", "p99(us)",
+         "reads/op", "writes/op", "syscalls/op");
+
+  int failed = 0;
+  for (size_t w = 0; w < NUM_WORKLOADS; w++) {
+    int selected = optind == argc;
+    for (int i = optind; i < argc; i++) {
+      if (strcmp(argv[i], workloads[w].name) == 0) {
+        selected = 1;
+      }
+    }
+    if (selected && run_workload(&workloads[w], filename, num_ops) < 0) {
+      failed = 1;
+    }
+  }
+
+  unlink(filename);
+  return failed;
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "jumbo_file_system.h"
+
+#define DISK_FILENAME "DISK"
+
+// names of the directories from the root to the current directory
+static const char* jfs_path[NUM_BLOCKS];
+static int jfs_depth = 0;
+
+static int num_dirs = 0;
+static int num_files = 0;
+static long num_bytes = 0;
+static int num_errors = 0;
+
+
+static void report(const char* host_path, const char* message) {
+  fprintf(stderr, "jfs_export: %s: %s\n", host_path, message);
+  num_errors++;
+}
+
+
+/* return_to_parent
+ *   makes the parent of the current directory the current directory again;
+ *   there is no ".." so this starts over at the root
+ */
+static int return_to_parent() {
+  jfs_depth--;
+  int ret = jfs_chdir(NULL);
+  for (int i = 0; i < jfs_depth && ret == E_SUCCESS; i++) {
+    ret = jfs_chdir(jfs_path[i]);
+  }
+  return ret;
+}
+
+
+/* export_file
+ *   copies a file in the current directory to a host file
+ */
+static void export_file(const char* host_path, const char* name) {
+  char data[MAX_FILE_SIZE];
+  unsigned short count = MAX_FILE_SIZE;
+  int ret = jfs_read(name, data, &count);
+  if (ret != E_SUCCESS) {
+    report(host_path, jfs_strerror(ret));
+    return;
+  }
+
+  FILE* out = fopen(host_path, "wb");
+  if (NULL == out) {
+    report(host_path, strerror(errno));
+    return;
+  }
+  if (fwrite(data, 1, count, out) != count) {
+    report(host_path, "write error");
+  } else {
+    num_files++;
+    num_bytes += count;
+  }
+  if (fclose(out) != 0) {
+    report(host_path, "write error");
+  }
+}
+
+
+/* export_dir
+ *   copies the contents of the current directory into a host directory
+ */
+static void export_dir(const char* host_dir) {
+  char names[LS_PACKED_SIZE];
+  int num_directories, num_files;
+  int ret = jfs_ls_packed(names, &num_directories, &num_files);
+  if (ret != E_SUCCESS) {
+    report(host_dir, jfs_strerror(ret));
+    return;
+  }
+  const char* directories[MAX_DIR_ENTRIES];
+  const char* files[MAX_DIR_ENTRIES];
+  const char* name = names;
+  for (int i = 0; i < num_directories + num_files; i++) {
+    if (i < num_directories) {
+      directories[i] = name;
+    } else {
+      files[i - num_directories] = name;
+    }
+    name += strlen(name) + 1;
+  }
+
+  char host_path[PATH_MAX];
+  for (int i = 0; i < num_files; i++) {
+    snprintf(host_path, sizeof(host_path), "%s/%s", host_dir, files[i]);
+    export_file(host_path, files[i]);
+  }
+
+  int lost = 0;
+  for (int i = 0; i < num_directories; i++) {
+    snprintf(host_path, sizeof(host_path), "%s/%s", host_dir, directories[i]);
+    if (lost) {
+      // cannot get back to this directory; skip the rest
+    } else if (mkdir(host_path, S_IRWXU | S_IRWXG | S_IRWXO) < 0 && errno != EEXIST) {
+      report(host_path, strerror(errno));
+    } else if ((ret = jfs_chdir(directories[i])) != E_SUCCESS) {
+      report(host_path, jfs_strerror(ret));
+    } else {
+      num_dirs++;
+      jfs_path[jfs_depth++] = directories[i];
+      export_dir(host_path);
+      if (return_to_parent() != E_SUCCESS) {
+        report(host_path, "lost the current directory");
+        lost = 1;
+      }
+    }
+  }
+}
+
+
+void usage(const char* name) {
+  fprintf(stderr, "usage: %s [-f disk_file] <hostdir>\n", name);
+  fprintf(stderr, "  copies the contents of the image into hostdir (created if needed)\n");
+}
+
+
+int main(int argc, char* argv[]) {
+  const char* filename = DISK_FILENAME;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:")) != -1) {
+    if ('f' == opt) {
+      filename = optarg;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  const char* host_dir = argv[optind];
+
+  // jfs_mount() would create and format a missing image
+  if (access(filename, R_OK | W_OK) < 0) {
+    perror(filename);
+    return 1;
+  }
+  if (mkdir(host_dir, S_IRWXU | S_IRWXG | S_IRWXO) < 0 && errno != EEXIST) {
+    perror(host_dir);
+    return 1;
+  }
+  if (jfs_mount(filename) < 0) {
+    fprintf(stderr, "jfs_export: could not mount %s\n", filename);
+    return 1;
+  }
+  export_dir(host_dir);
+  jfs_unmount();
+
+  printf("exported %d directories, %d files, %ld bytes (%d errors)\n",
+         num_dirs, num_files, num_bytes, num_errors);
+  return num_errors > 0;
+}
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "jumbo_file_system.h"
+
+#define DISK_FILENAME "DISK"
+#define CHUNK_BLOCKS 8 // file data is written in chunks of this many full blocks
+
+// names of the directories from the root to the current directory
+static const char* jfs_path[NUM_BLOCKS];
+static int jfs_depth = 0;
+
+static int num_dirs = 0;
+static int num_files = 0;
+static long num_bytes = 0;
+static int num_errors = 0;
+
+
+static void report(const char* host_path, const char* message) {
+  fprintf(stderr, "jfs_import: %s: %s\n", host_path, message);
+  num_errors++;
+}
+
+
+/* return_to_parent
+ *   makes the parent of the current directory the current directory again;
+ *   there is no ".." so this starts over at the root
+ */
+static int return_to_parent() {
+  jfs_depth--;
+  int ret = jfs_chdir(NULL);
+  for (int i = 0; i < jfs_depth && ret == E_SUCCESS; i++) {
+    ret = jfs_chdir(jfs_path[i]);
+  }
+  return ret;
+}
+
+
+/* import_file
+ *   creates a file in the current directory and copies the host file into it
+ *   in chunks of full blocks, so no data block is written twice
+ */
+static void import_file(const char* host_path, const char* name, off_t size) {
+  if (size > (off_t) MAX_FILE_SIZE) {
+    report(host_path, jfs_strerror(E_MAX_FILE_SIZE));
+    return;
+  }
+  FILE* in = fopen(host_path, "rb");
+  if (NULL == in) {
+    report(host_path, "could not open");
+    return;
+  }
+
+  int ret = jfs_creat(name);
+  if (ret != E_SUCCESS) {
+    report(host_path, jfs_strerror(ret));
+    fclose(in);
+    return;
+  }
+
+  char chunk[CHUNK_BLOCKS * BLOCK_SIZE];
+  size_t len;
+  while ((len = fread(chunk, 1, sizeof(chunk), in)) > 0) {
+    ret = jfs_write(name, chunk, len);
+    if (ret != E_SUCCESS) {
+      report(host_path, jfs_strerror(ret));
+      jfs_remove(name);
+      fclose(in);
+      return;
+    }
+    num_bytes += len;
+  }
+  if (ferror(in)) {
+    report(host_path, "read error");
+    jfs_remove(name);
+  } else {
+    num_files++;
+  }
+  fclose(in);
+}
+
+
+/* import_dir
+ *   copies the contents of a host directory into the current directory
+ */
+static void import_dir(const char* host_dir) {
+  DIR* d = opendir(host_dir);
+  if (NULL == d) {
+    report(host_dir, "could not open directory");
+    return;
+  }
+
+  struct dirent* entry;
+  while (NULL != (entry = readdir(d))) {
+    const char* name = entry->d_name;
+    if (0 == strcmp(name, ".") || 0 == strcmp(name, "..")) {
+      continue;
+    }
+    char host_path[PATH_MAX];
+    snprintf(host_path, sizeof(host_path), "%s/%s", host_dir, name);
+    if (strlen(name) > MAX_NAME_LENGTH) {
+      report(host_path, jfs_strerror(E_MAX_NAME_LENGTH));
+      continue;
+    }
+
+    struct stat st;
+    if (lstat(host_path, &st) < 0) {
+      report(host_path, "could not stat");
+
+    } else if (S_ISDIR(st.st_mode)) {
+      // an existing directory is merged into
+      int ret = jfs_mkdir(name);
+      if (ret == E_SUCCESS) {
+        num_dirs++;
+      } else if (ret != E_EXISTS) {
+        report(host_path, jfs_strerror(ret));
+        continue;
+      }
+      ret = jfs_chdir(name);
+      if (ret != E_SUCCESS) {
+        report(host_path, jfs_strerror(ret));
+        continue;
+      }
+
+      // entry->d_name is overwritten by later readdir() calls
+      char* saved_name = strdup(name);
+      jfs_path[jfs_depth++] = saved_name;
+      import_dir(host_path);
+      if (return_to_parent() != E_SUCCESS) {
+        report(host_path, "lost the current directory");
+        free(saved_name);
+        break;
+      }
+      free(saved_name);
+
+    } else if (S_ISREG(st.st_mode)) {
+      import_file(host_path, name, st.st_size);
+
+    } else {
+      report(host_path, "not a regular file or directory; skipped");
+    }
+  }
+  closedir(d);
+}
+
+
+void usage(const char* name) {
+  fprintf(stderr, "usage: %s [-f disk_file] <hostdir>\n", name);
+  fprintf(stderr, "  copies the contents of hostdir into the root directory of the image\n");
+}
+
+
+int main(int argc, char* argv[]) {
+  const char* filename = DISK_FILENAME;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:")) != -1) {
+    if ('f' == opt) {
+      filename = optarg;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  if (jfs_mount(filename) < 0) {
+    fprintf(stderr, "jfs_import: could not mount %s\n", filename);
+    return 1;
+  }
+  import_dir(argv[optind]);
+  jfs_unmount();
+
+  printf("imported %d directories, %d files, %ld bytes (%d errors)\n",
+         num_dirs, num_files, num_bytes, num_errors);
+  return num_errors > 0;
+}
@@ -0,0 +1,405 @@
+#include "jumbo_file_system.h"
+#include "jfsd.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+/* The jfs_* functions as a client of jfsd: linked instead of the file
+ * system itself, each call is sent to the server that owns the image and
+ * waits for its reply.  jfs_mount() connects to the image's server socket
+ * (or to $JFSD_SOCKET).  Function comments are in jumbo_file_system.c.
+ */
+
+static int server_fd = -1;
+
+// data of the last reply
+static char* reply_data = NULL;
+static size_t reply_cap = 0;
+static uint32_t reply_len = 0;
+
+// where jfs_unmount() writes the server's stats (see jfs_set_stats_file())
+static char* stats_filename = NULL;
+
+
+// reads exactly len bytes
+static int read_all(void* buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = read(server_fd, (char*) buf + done, len - done);
+    if (n <= 0) {
+      return -1;
+    }
+    done += n;
+  }
+  return 0;
+}
+
+
+/* call
+ *   sends a request and waits for its reply, whose data is left in
+ *   reply_data
+ * name, name2 - the request's strings (NULL for fewer)
+ * data, len - the request's data
+ * returns the value the server's jfs_* function returned, or E_UNKNOWN if
+ *   the server could not be reached
+ */
+static int call(int op, uint16_t arg0, uint16_t arg1, const char* name,
+                const char* name2, const void* data, size_t len) {
+  struct jfsd_request req = {0, op, {arg0, arg1}};
+  struct iovec iov[4];
+  int num_iov = 0;
+  iov[num_iov].iov_base = &req;
+  iov[num_iov++].iov_len = sizeof(req);
+  if (NULL != name) {
+    iov[num_iov].iov_base = (void*) name;
+    iov[num_iov++].iov_len = strlen(name) + 1;
+  }
+  if (NULL != name2) {
+    iov[num_iov].iov_base = (void*) name2;
+    iov[num_iov++].iov_len = strlen(name2) + 1;
+  }
+  if (len > 0) {
+    iov[num_iov].iov_base = (void*) data;
+    iov[num_iov++].iov_len = len;
+  }
+  size_t total = 0;
+  for (int i = 1; i < num_iov; i++) {
+    total += iov[i].iov_len;
+  }
+  if (total > JFSD_MAX_REQUEST) {
+    return E_INVALID;
+  }
+  req.length = total;
+
+  // normally a single sendmsg() sends the whole request; a server that has
+  // gone away makes the call fail rather than raise SIGPIPE
+  struct iovec* next = iov;
+  while (num_iov > 0) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = next;
+    msg.msg_iovlen = num_iov;
+    ssize_t n = sendmsg(server_fd, &msg, MSG_NOSIGNAL);
+    if (n < 0) {
+      return E_UNKNOWN;
+    }
+    while (num_iov > 0 && (size_t) n >= next->iov_len) {
+      n -= next->iov_len;
+      next++;
+      num_iov--;
+    }
+    if (num_iov > 0) {
+      next->iov_base = (char*) next->iov_base + n;
+      next->iov_len -= n;
+    }
+  }
+
+  struct jfsd_reply reply;
+  if (read_all(&reply, sizeof(reply)) < 0) {
+    return E_UNKNOWN;
+  }
+  if (reply.length > reply_cap) {
+    char* buf = realloc(reply_data, reply.length);
+    if (NULL == buf) {
+      return E_UNKNOWN;
+    }
+    reply_data = buf;
+    reply_cap = reply.length;
+  }
+  if (read_all(reply_data, reply.length) < 0) {
+    return E_UNKNOWN;
+  }
+  reply_len = reply.length;
+  return reply.ret;
+}
+
+
+/* get_names
+ *   copies a list of names from the reply (each ending in '\0', and the list
+ *   ending in "") into malloced strings followed by NULL
+ * returns the position in the reply after the list
+ */
+static size_t get_names(size_t pos, char* names[]) {
+  int n = 0;
+  while (pos < reply_len && '\0' != reply_data[pos]) {
+    names[n] = strdup(reply_data + pos);
+    pos += strlen(names[n++]) + 1;
+  }
+  names[n] = NULL;
+  return pos + 1;
+}
+
+
+// copies a struct from the reply, if it has one
+static int get_struct(int ret, void* buf, size_t len) {
+  if (ret == E_SUCCESS) {
+    if (reply_len != len) {
+      return E_UNKNOWN;
+    }
+    memcpy(buf, reply_data, len);
+  }
+  return ret;
+}
+
+
+int jfs_mount(const char* filename) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  const char* path = getenv("JFSD_SOCKET");
+  if (NULL != path) {
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+  } else {
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s%s", filename, JFSD_SOCKET_SUFFIX);
+  }
+
+  server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server_fd < 0) {
+    return E_UNKNOWN;
+  }
+  if (connect(server_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    close(server_fd);
+    server_fd = -1;
+    return E_UNKNOWN;
+  }
+  return E_SUCCESS;
+}
+
+
+int jfs_mkdir(const char* directory_name) {
+  return call(JFSD_MKDIR, 0, 0, directory_name, NULL, NULL, 0);
+}
+
+
+int jfs_chdir(const char* directory_name) {
+  return call(JFSD_CHDIR, 0, 0, directory_name, NULL, NULL, 0);
+}
+
+
+int jfs_ls(char* directories[MAX_DIR_ENTRIES+1], char* files[MAX_DIR_ENTRIES+1]) {
+  int ret = call(JFSD_LS, 0, 0, NULL, NULL, NULL, 0);
+  if (ret == E_SUCCESS) {
+    get_names(get_names(0, directories), files);
+  }
+  return ret;
+}
+
+
+int jfs_ls_packed(char names[LS_PACKED_SIZE], int* num_directories, int* num_files) {
+  int ret = call(JFSD_LS, 0, 0, NULL, NULL, NULL, 0);
+  if (ret != E_SUCCESS) {
+    return ret;
+  }
+  // the reply is the same packed names, with an extra "" after each list
+  int* count = num_directories;
+  *num_directories = *num_files = 0;
+  size_t len = 0;
+  for (size_t pos = 0; pos < reply_len; ) {
+    size_t n = strnlen(reply_data + pos, reply_len - pos);
+    if (n == 0 && count == num_directories) {
+      count = num_files;
+    } else if (n == 0) {
+      break;
+    } else if (len + n + 1 > LS_PACKED_SIZE) {
+      return E_UNKNOWN;
+    } else {
+      memcpy(names + len, reply_data + pos, n);
+      names[len + n] = '\0';
+      len += n + 1;
+      (*count)++;
+    }
+    pos += n + 1;
+  }
+  return ret;
+}
+
+
+int jfs_rmdir(const char* directory_name) {
+  return call(JFSD_RMDIR, 0, 0, directory_name, NULL, NULL, 0);
+}
+
+
+int jfs_creat(const char* file_name) {
+  return call(JFSD_CREAT, 0, 0, file_name, NULL, NULL, 0);
+}
+
+
+int jfs_remove(const char* file_name) {
+  return call(JFSD_REMOVE, 0, 0, file_name, NULL, NULL, 0);
+}
+
+
+int jfs_rename(const char* old_path, const char* new_path) {
+  return call(JFSD_RENAME, 0, 0, old_path, new_path, NULL, 0);
+}
+
+
+int jfs_stat(const char* name, struct stats* buf) {
+  return get_struct(call(JFSD_STAT, 0, 0, name, NULL, NULL, 0), buf, sizeof(*buf));
+}
+
+
+int jfs_write(const char* file_name, const void* buf, unsigned short count) {
+  return call(JFSD_WRITE, 0, 0, file_name, NULL, buf, count);
+}
+
+
+int jfs_read(const char* file_name, void* buf, unsigned short* ptr_count) {
+  int ret = call(JFSD_READ, *ptr_count, 0, file_name, NULL, NULL, 0);
+  if (ret == E_SUCCESS) {
+    if (reply_len > *ptr_count) {
+      return E_UNKNOWN;
+    }
+    memcpy(buf, reply_data, reply_len);
+    *ptr_count = reply_len;
+  }
+  return ret;
+}
+
+
+int jfs_truncate(const char* file_name, unsigned short size) {
+  return call(JFSD_TRUNCATE, size, 0, file_name, NULL, NULL, 0);
+}
+
+
+int jfs_punch_hole(const char* file_name, unsigned short offset, unsigned short length) {
+  return call(JFSD_PUNCH_HOLE, offset, length, file_name, NULL, NULL, 0);
+}
+
+
+int jfs_remove_tree(const char* name) {
+  return call(JFSD_REMOVE_TREE, 0, 0, name, NULL, NULL, 0);
+}
+
+
+int jfs_du(const char* name, struct du_stats* buf) {
+  return get_struct(call(JFSD_DU, 0, 0, name, NULL, NULL, 0), buf, sizeof(*buf));
+}
+
+
+int jfs_walk(jfs_visitor_t visitor, void* arg) {
+  int ret = call(JFSD_WALK, 0, 0, NULL, NULL, NULL, 0);
+  if (ret != E_SUCCESS) {
+    return ret;
+  }
+  // the visitor may make calls of its own, which replace reply_data
+  char* entries = malloc(reply_len + 1);
+  size_t len = reply_len;
+  if (NULL == entries) {
+    return E_UNKNOWN;
+  }
+  memcpy(entries, reply_data, len);
+
+  size_t pos = 0;
+  while (ret == 0 && pos + sizeof(struct stats) < len) {
+    struct stats st;
+    memcpy(&st, entries + pos, sizeof(st));
+    const char* path = entries + pos + sizeof(st);
+    pos += sizeof(st) + strlen(path) + 1;
+    ret = visitor(path, &st, arg);
+  }
+  free(entries);
+  return ret;
+}
+
+
+int jfs_statfs(struct fs_stats* buf) {
+  return get_struct(call(JFSD_STATFS, 0, 0, NULL, NULL, NULL, 0), buf, sizeof(*buf));
+}
+
+
+int jfs_snapshot(const char* snapshot_name) {
+  return call(JFSD_SNAPSHOT, 0, 0, snapshot_name, NULL, NULL, 0);
+}
+
+
+int jfs_rollback(const char* snapshot_name) {
+  return call(JFSD_ROLLBACK, 0, 0, snapshot_name, NULL, NULL, 0);
+}
+
+
+int jfs_delete_snapshot(const char* snapshot_name) {
+  return call(JFSD_DELETE_SNAPSHOT, 0, 0, snapshot_name, NULL, NULL, 0);
+}
+
+
+int jfs_list_snapshots(char* snapshot_names[MAX_SNAPSHOTS+1]) {
+  int ret = call(JFSD_LIST_SNAPSHOTS, 0, 0, NULL, NULL, NULL, 0);
+  if (ret == E_SUCCESS) {
+    get_names(0, snapshot_names);
+  }
+  return ret;
+}
+
+
+int jfs_set_dedup(int enable) {
+  return call(JFSD_SET_DEDUP, enable != 0, 0, NULL, NULL, NULL, 0);
+}
+
+
+int jfs_set_compression(int enable) {
+  return call(JFSD_SET_COMPRESSION, enable != 0, 0, NULL, NULL, NULL, 0);
+}
+
+
+int jfs_set_checksums(int enable) {
+  return call(JFSD_SET_CHECKSUMS, enable != 0, 0, NULL, NULL, NULL, 0);
+}
+
+
+// reads are made by the server, with the block cache on
+int jfs_set_read_threads(int num_threads) {
+  return 1 == num_threads ? E_SUCCESS : E_INVALID;
+}
+
+
+// jfsd keeps every block it has used in its cache, and re-enters each
+// client's directory with jfs_chdir() on every switch, so it does not prefetch
+int jfs_set_prefetch(int enable) {
+  return 0 == enable ? E_SUCCESS : E_INVALID;
+}
+
+
+// the stats are the server's, for the calls of all its clients
+int jfs_print_stats(FILE* out, int json) {
+  int ret = call(JFSD_PRINT_STATS, json != 0, 0, NULL, NULL, NULL, 0);
+  if (ret == E_SUCCESS) {
+    fwrite(reply_data, 1, reply_len, out);
+  }
+  return ret;
+}
+
+
+int jfs_reset_stats() {
+  return call(JFSD_RESET_STATS, 0, 0, NULL, NULL, NULL, 0);
+}
+
+
+int jfs_set_stats_file(const char* filename) {
+  free(stats_filename);
+  stats_filename = filename != NULL ? strdup(filename) : NULL;
+  return E_SUCCESS;
+}
+
+
+// calls are traced by the server (jfsd -t), where they are timed
+int jfs_set_trace_file(const char* filename) {
+  return NULL == filename ? E_SUCCESS : E_INVALID;
+}
+
+
+int jfs_unmount() {
+  if (NULL != stats_filename) {
+    FILE* out = fopen(stats_filename, "w");
+    if (NULL != out) {
+      jfs_print_stats(out, 1);
+      fclose(out);
+    }
+  }
+  int ret = close(server_fd);
+  server_fd = -1;
+  return ret < 0 ? E_UNKNOWN : E_SUCCESS;
+}
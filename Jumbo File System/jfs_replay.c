@@ -0,0 +1,286 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "jumbo_file_system.h"
+#include "trace.h"
+
+#define REPLAY_FILENAME "REPLAY_DISK"
+#define MAX_THREADS 64
+
+/* Replays a trace recorded with command_line -t (or jfsd -t) against a
+ * fresh image.  The file system has one current directory and no locks, so
+ * calls always run one at a time and in trace order; with several threads
+ * each call is handed to the next thread under a global mutex, the way a
+ * server with a thread per client would run them.
+ */
+
+// a recorded call, pointing into the loaded trace
+struct call {
+  struct trace_record rec;
+  const char* name[2];
+  const char* data;
+};
+
+static struct call* calls;
+static int num_calls = 0;
+
+static int timed = 0;    // keep the recorded time between calls
+static uint64_t start_ns; // when the replay started
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t turn_changed = PTHREAD_COND_INITIALIZER;
+static int next_claim = 0; // next call a thread will take
+static int next_run = 0;   // next call to run
+static int num_mismatches = 0; // calls that returned something else this time
+
+static char read_buf[0x10000];
+
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/* load_trace
+ *   reads a whole trace into memory and splits it into calls
+ * returns 0 on success or -1 on failure
+ */
+static int load_trace(const char* filename) {
+  FILE* in = fopen(filename, "rb");
+  if (NULL == in) {
+    perror(filename);
+    return -1;
+  }
+  fseek(in, 0, SEEK_END);
+  long size = ftell(in);
+  rewind(in);
+  char* buf = malloc(size > 0 ? size : 1);
+  if (NULL == buf || size < (long) sizeof(struct trace_header) ||
+      fread(buf, 1, size, in) != (size_t) size) {
+    fprintf(stderr, "jfs_replay: %s: could not read the trace\n", filename);
+    fclose(in);
+    return -1;
+  }
+  fclose(in);
+
+  struct trace_header header;
+  memcpy(&header, buf, sizeof(header));
+  if (header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+    fprintf(stderr, "jfs_replay: %s: not a trace\n", filename);
+    return -1;
+  }
+  if (header.block_size != BLOCK_SIZE) {
+    fprintf(stderr, "jfs_replay: warning: the trace was recorded with %d-byte blocks, not %d\n",
+            header.block_size, BLOCK_SIZE);
+  }
+
+  // each call takes at least a record
+  calls = malloc((size / sizeof(struct trace_record) + 1) * sizeof(struct call));
+  long pos = sizeof(header);
+  while (pos + (long) sizeof(struct trace_record) <= size) {
+    struct call* c = &calls[num_calls];
+    memcpy(&c->rec, buf + pos, sizeof(c->rec));
+    pos += sizeof(c->rec);
+    long len = c->rec.name_len[0] + c->rec.name_len[1] + c->rec.data_len;
+    if (c->rec.op >= NUM_OPS || pos + len > size) {
+      break;
+    }
+    for (int i = 0; i < 2; i++) {
+      c->name[i] = c->rec.name_len[i] > 0 ? buf + pos : NULL;
+      pos += c->rec.name_len[i];
+    }
+    c->data = buf + pos;
+    pos += c->rec.data_len;
+    num_calls++;
+  }
+  if (pos != size) {
+    fprintf(stderr, "jfs_replay: %s: trace is cut short after %d calls\n", filename, num_calls);
+  }
+  return 0;
+}
+
+
+static int ignore_entry(const char* path, const struct stats* st, void* arg) {
+  (void) path;
+  (void) st;
+  (void) arg;
+  return 0;
+}
+
+
+/* run_call
+ *   makes a recorded call again
+ * returns what it returned
+ */
+static int run_call(const struct call* c) {
+  const char* name = c->name[0];
+  switch (c->rec.op) {
+  case OP_MKDIR:
+    return jfs_mkdir(name);
+  case OP_CHDIR:
+    return jfs_chdir(name);
+  case OP_LS: {
+    char names[LS_PACKED_SIZE];
+    int num_directories, num_files;
+    return jfs_ls_packed(names, &num_directories, &num_files);
+  }
+  case OP_RMDIR:
+    return jfs_rmdir(name);
+  case OP_CREAT:
+    return jfs_creat(name);
+  case OP_REMOVE:
+    return jfs_remove(name);
+  case OP_RENAME:
+    return jfs_rename(name, c->name[1]);
+  case OP_STAT: {
+    struct stats st;
+    return jfs_stat(name, &st);
+  }
+  case OP_WRITE:
+    return jfs_write(name, c->data, c->rec.data_len);
+  case OP_READ: {
+    unsigned short count = c->rec.arg[0];
+    return jfs_read(name, read_buf, &count);
+  }
+  case OP_TRUNCATE:
+    return jfs_truncate(name, c->rec.arg[0]);
+  case OP_PUNCH_HOLE:
+    return jfs_punch_hole(name, c->rec.arg[0], c->rec.arg[1]);
+  case OP_REMOVE_TREE:
+    return jfs_remove_tree(name);
+  case OP_DU: {
+    struct du_stats usage;
+    return jfs_du(name, &usage);
+  }
+  case OP_WALK:
+    return jfs_walk(ignore_entry, NULL);
+  case OP_SNAPSHOT:
+    return jfs_snapshot(name);
+  case OP_ROLLBACK:
+    return jfs_rollback(name);
+  case OP_DELETE_SNAPSHOT:
+    return jfs_delete_snapshot(name);
+  case OP_SET_DEDUP:
+    return jfs_set_dedup(c->rec.arg[0]);
+  case OP_SET_COMPRESSION:
+    return jfs_set_compression(c->rec.arg[0]);
+  }
+  return E_INVALID;
+}
+
+
+static void* replay_thread(void* arg) {
+  (void) arg;
+  for (;;) {
+    pthread_mutex_lock(&lock);
+    int i = next_claim++;
+    pthread_mutex_unlock(&lock);
+    if (i >= num_calls) {
+      return NULL;
+    }
+
+    if (timed) {
+      uint64_t at = start_ns + calls[i].rec.start_ns;
+      struct timespec ts = {at / 1000000000, at % 1000000000};
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {}
+    }
+
+    pthread_mutex_lock(&lock);
+    while (next_run != i) {
+      pthread_cond_wait(&turn_changed, &lock);
+    }
+    if (run_call(&calls[i]) != calls[i].rec.ret) {
+      num_mismatches++;
+    }
+    next_run++;
+    pthread_cond_broadcast(&turn_changed);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+
+void usage(const char* name) {
+  fprintf(stderr, "usage: %s [-t] [-j threads] [-f image] [-s stats_file] trace_file\n", name);
+  fprintf(stderr, "  -t  keep the recorded time between calls (default: as fast as possible)\n");
+  fprintf(stderr, "  -j  threads making the calls (default 1, at most %d)\n", MAX_THREADS);
+  fprintf(stderr, "  -f  scratch image, overwritten (default %s)\n", REPLAY_FILENAME);
+  fprintf(stderr, "  -s  also write the per-operation stats to stats_file as JSON\n");
+}
+
+
+int main(int argc, char* argv[]) {
+  const char* filename = REPLAY_FILENAME;
+  const char* stats_filename = NULL;
+  int num_threads = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, "tj:f:s:")) != -1) {
+    switch (opt) {
+    case 't':
+      timed = 1;
+      break;
+    case 'j':
+      num_threads = atoi(optarg);
+      break;
+    case 'f':
+      filename = optarg;
+      break;
+    case 's':
+      stats_filename = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc - 1 || num_threads < 1 || num_threads > MAX_THREADS) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (load_trace(argv[optind]) < 0) {
+    return 1;
+  }
+
+  unlink(filename);
+  if (jfs_mount(filename) < 0) {
+    fprintf(stderr, "jfs_replay: could not mount %s\n", filename);
+    return 1;
+  }
+  jfs_set_stats_file(stats_filename);
+  jfs_reset_stats();
+
+  pthread_t threads[MAX_THREADS];
+  start_ns = now_ns();
+  for (int t = 0; t < num_threads; t++) {
+    pthread_create(&threads[t], NULL, replay_thread, NULL);
+  }
+  for (int t = 0; t < num_threads; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  uint64_t elapsed = now_ns() - start_ns;
+
+  uint64_t recorded_span = 0;
+  uint64_t recorded_busy = 0;
+  for (int i = 0; i < num_calls; i++) {
+    recorded_busy += calls[i].rec.latency_ns;
+  }
+  if (num_calls > 0) {
+    recorded_span = calls[num_calls - 1].rec.start_ns + calls[num_calls - 1].rec.latency_ns;
+  }
+  printf("%d calls in %.3f s (%.0f calls/s) with %d thread(s)\n",
+         num_calls, elapsed / 1e9, num_calls / (elapsed / 1e9), num_threads);
+  printf("recorded: %.3f s, of which %.3f s in calls\n", recorded_span / 1e9, recorded_busy / 1e9);
+  if (num_mismatches > 0) {
+    printf("%d calls returned something other than when they were recorded\n", num_mismatches);
+  }
+  printf("\n");
+  jfs_print_stats(stdout, 0);
+
+  jfs_unmount();
+  unlink(filename);
+  return 0;
+}
@@ -0,0 +1,40 @@
+#include "jumbo_file_system.h"
+
+// kept apart from jumbo_file_system.c so jfs_remote.c can share it
+
+/* jfs_strerror
+ *   returns a short description of one of the E_* error codes
+ * err - the error code returned by a jfs_* function
+ */
+const char *jfs_strerror(int err)
+{
+  switch (err)
+  {
+  case E_SUCCESS:
+    return "success";
+  case E_NOT_EXISTS:
+    return "no such file or directory";
+  case E_EXISTS:
+    return "already exists";
+  case E_NOT_DIR:
+    return "not a directory";
+  case E_IS_DIR:
+    return "is a directory";
+  case E_NOT_EMPTY:
+    return "directory not empty";
+  case E_MAX_NAME_LENGTH:
+    return "name too long";
+  case E_MAX_DIR_ENTRIES:
+    return "directory is full";
+  case E_MAX_FILE_SIZE:
+    return "file too large";
+  case E_DISK_FULL:
+    return "disk is full";
+  case E_MAX_SNAPSHOTS:
+    return "too many snapshots";
+  case E_INVALID:
+    return "invalid argument";
+  default:
+    return "unknown error";
+  }
+}
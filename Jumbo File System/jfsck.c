@@ -0,0 +1,430 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "jumbo_file_system.h"
+
+#define DISK_FILENAME "DISK"
+#define DEFAULT_WORKERS 4
+#define BATCH_BLOCKS 64 // blocks read per syscall
+
+/* Exit codes (same meaning as e2fsck) */
+#define FSCK_OK 0
+#define FSCK_REPAIRED 1
+#define FSCK_UNCORRECTED 4
+#define FSCK_ERROR 8
+
+
+// the whole image, read in parallel batches before the tree walk
+static char image[NUM_BLOCKS][BLOCK_SIZE];
+
+// bitmap of the blocks reachable from the root directory, plus metadata blocks
+static unsigned char reachable[NUM_BLOCKS / 8];
+
+// union of the snapshot bitmaps: blocks kept for snapshots, which are not free
+static unsigned char frozen[NUM_BLOCKS / 8];
+
+// number of inode references to each data block; more than one is only valid
+// for images with a reference count table (dedup)
+static int data_refs[NUM_BLOCKS];
+static int has_refcounts = 0;
+
+static int num_problems = 0;
+
+
+static int get_bit(const unsigned char* bitmap, block_num_t block) {
+  return (bitmap[block / 8] >> (block % 8)) & 1;
+}
+
+static void set_bit(unsigned char* bitmap, block_num_t block) {
+  bitmap[block / 8] |= 1 << (block % 8);
+}
+
+static void clear_bit(unsigned char* bitmap, block_num_t block) {
+  bitmap[block / 8] &= ~(1 << (block % 8));
+}
+
+
+/* read_worker
+ *   reads every num_workers-th batch of the image, starting at its own index
+ */
+struct worker_args {
+  int index;
+  int num_workers;
+  int failed;
+};
+
+static void* read_worker(void* arg) {
+  struct worker_args* args = (struct worker_args*) arg;
+  for (int first = args->index * BATCH_BLOCKS;
+       first < NUM_BLOCKS;
+       first += args->num_workers * BATCH_BLOCKS) {
+    int count = NUM_BLOCKS - first < BATCH_BLOCKS ? NUM_BLOCKS - first : BATCH_BLOCKS;
+    if (read_blocks(first, count, image[first]) < 0) {
+      args->failed = 1;
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+
+/* read_image
+ *   reads all blocks of the image using num_workers threads
+ * returns 0 on success or -1 on failure
+ */
+static int read_image(int num_workers) {
+  pthread_t threads[num_workers];
+  struct worker_args args[num_workers];
+  int started = 0;
+  int ret = 0;
+
+  for (int i = 0; i < num_workers; i++) {
+    args[i].index = i;
+    args[i].num_workers = num_workers;
+    args[i].failed = 0;
+    if (pthread_create(&threads[i], NULL, read_worker, &args[i]) != 0) {
+      ret = -1;
+      break;
+    }
+    started++;
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
+    if (args[i].failed) {
+      ret = -1;
+    }
+  }
+  return ret;
+}
+
+
+/* mark_reachable
+ *   marks a block referenced by the tree as reachable
+ * returns 1 if the block may be descended into, or 0 if the reference is bad
+ */
+static int mark_reachable(block_num_t block, block_num_t parent) {
+  if (block == BITMAP_BLOCK || block == SUPERBLOCK_BLOCK || block >= NUM_BLOCKS) {
+    printf("block %u: invalid reference to block %u\n", parent, block);
+    num_problems++;
+    return 0;
+  }
+  if (get_bit(reachable, block)) {
+    printf("block %u: block %u is referenced more than once\n", parent, block);
+    num_problems++;
+    return 0;
+  }
+  set_bit(reachable, block);
+  return 1;
+}
+
+
+/* mark_data
+ *   marks a data block referenced by an inode; with dedup a data block may be
+ *   shared by several inodes, and block 0 stands for a hole
+ */
+static void mark_data(block_num_t block, block_num_t parent) {
+  if (block == 0) {
+    return; // a hole
+  }
+  if (has_refcounts && block < NUM_BLOCKS && data_refs[block] > 0) {
+    data_refs[block]++;
+  } else if (mark_reachable(block, parent)) {
+    data_refs[block]++;
+  }
+}
+
+
+/* mark_refcounts
+ *   marks the reference count table as in use
+ */
+static void mark_refcounts(const struct superblock* sb) {
+  if (!has_refcounts) {
+    return;
+  }
+  for (int i = 0; i < REFCOUNT_BLOCKS; i++) {
+    mark_reachable(sb->refcount_blocks[i], SUPERBLOCK_BLOCK);
+  }
+}
+
+
+/* check_refcounts
+ *   compares the number of references to each data block against the
+ *   reference count table, and fixes the in-memory table
+ * returns 1 if the table was changed, or 0 otherwise
+ */
+static int check_refcounts(const struct superblock* sb) {
+  if (!has_refcounts) {
+    return 0;
+  }
+  int changed = 0;
+  for (block_num_t block = 0; block < NUM_BLOCKS; block++) {
+    block_num_t table_block = sb->refcount_blocks[block / BLOCK_SIZE];
+    if (table_block >= NUM_BLOCKS) {
+      continue; // reported by mark_refcounts()
+    }
+    unsigned char* count = (unsigned char*) &image[table_block][block % BLOCK_SIZE];
+    int extra = data_refs[block] > 1 ? data_refs[block] - 1 : 0;
+    if (*count != extra) {
+      printf("block %u: reference count %u, should be %d\n", block, *count, extra);
+      *count = extra;
+      num_problems++;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/* mark_snapshots
+ *   marks the snapshot table and snapshot bitmaps as in use, and records the
+ *   blocks the snapshots keep
+ */
+static void mark_snapshots(const struct superblock* sb) {
+  if (sb->snapshot_block == 0) {
+    return;
+  }
+  if (!mark_reachable(sb->snapshot_block, SUPERBLOCK_BLOCK)) {
+    return;
+  }
+  struct snapshot_table* table = (struct snapshot_table*) image[sb->snapshot_block];
+  if (table->num_snapshots > MAX_SNAPSHOTS) {
+    printf("snapshot table %u: bad snapshot count %u\n", sb->snapshot_block, table->num_snapshots);
+    num_problems++;
+    return;
+  }
+  for (int i = 0; i < table->num_snapshots; i++) {
+    block_num_t bitmap_block = table->snapshots[i].bitmap_block;
+    if (mark_reachable(bitmap_block, sb->snapshot_block)) {
+      for (int byte = 0; byte < NUM_BLOCKS / 8; byte++) {
+        frozen[byte] |= image[bitmap_block][byte];
+      }
+    }
+  }
+}
+
+
+/* walk_tree
+ *   walks the directory tree from the root and records every reachable block
+ */
+static void walk_tree(block_num_t root_block) {
+  block_num_t stack[NUM_BLOCKS];
+  int top = 0;
+
+  set_bit(reachable, BITMAP_BLOCK);
+  set_bit(reachable, SUPERBLOCK_BLOCK);
+  if (!mark_reachable(root_block, SUPERBLOCK_BLOCK)) {
+    return;
+  }
+  stack[top++] = root_block;
+
+  while (top > 0) {
+    block_num_t block_num = stack[--top];
+    struct block* blk = (struct block*) image[block_num];
+
+    if (blk->is_dir == 0) {
+      uint16_t num_entries = blk->contents.dirnode.num_entries;
+      if (num_entries > MAX_DIR_ENTRIES) {
+        printf("directory %u: bad entry count %u\n", block_num, num_entries);
+        num_problems++;
+        num_entries = MAX_DIR_ENTRIES;
+      }
+      for (int i = 0; i < num_entries; i++) {
+        block_num_t child = blk->contents.dirnode.entries[i].block_num;
+        if (mark_reachable(child, block_num)) {
+          stack[top++] = child;
+        }
+      }
+
+    } else {
+      uint32_t file_size = blk->contents.inode.file_size;
+      if ((blk->flags & INODE_COMPRESSED) && blk->contents.inode.stored_size != 0) {
+        file_size = blk->contents.inode.stored_size; // only the compressed bytes are stored
+      }
+      if (file_size > MAX_FILE_SIZE) {
+        printf("inode %u: bad file size %u\n", block_num, file_size);
+        num_problems++;
+        file_size = MAX_FILE_SIZE;
+      }
+      int num_data_blocks = (file_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+      if (file_size <= MAX_INLINE_SIZE) {
+        num_data_blocks = 0; // stored inline
+      }
+      for (int i = 0; i < num_data_blocks; i++) {
+        mark_data(blk->contents.inode.data_blocks[i], block_num);
+      }
+    }
+  }
+}
+
+
+/* check_bitmap
+ *   compares the reachable blocks against the allocation bitmap and fixes the
+ *   in-memory bitmap; leaked blocks are freed, and blocks in use but marked
+ *   free are marked allocated
+ * returns the number of free blocks (neither allocated nor kept for a
+ *   snapshot) according to the fixed bitmap
+ */
+static int check_bitmap(unsigned char* bitmap) {
+  int free_blocks = 0;
+  for (block_num_t block = 0; block < NUM_BLOCKS; block++) {
+    int used = get_bit(reachable, block);
+    int allocated = get_bit(bitmap, block);
+    if (allocated && !used) {
+      printf("block %u: allocated but unreachable (leaked)\n", block);
+      clear_bit(bitmap, block);
+      num_problems++;
+    } else if (!allocated && used) {
+      printf("block %u: in use but marked free\n", block);
+      set_bit(bitmap, block);
+      num_problems++;
+    }
+    if (!get_bit(bitmap, block) && !get_bit(frozen, block)) {
+      free_blocks++;
+    }
+  }
+  return free_blocks;
+}
+
+
+void usage(const char* name) {
+  fprintf(stderr, "usage: %s [-n] [-j workers] [disk_file]\n", name);
+  fprintf(stderr, "  -n  check only; do not repair.  The image is only read, so it can be\n"
+                  "      checked while mounted, but then operations in progress may show\n"
+                  "      up as problems.  Repairs need the image unmounted.\n");
+  fprintf(stderr, "  -j  number of threads reading the image (default %d)\n", DEFAULT_WORKERS);
+}
+
+
+int main(int argc, char* argv[]) {
+  int repair = 1;
+  int num_workers = DEFAULT_WORKERS;
+  int opt;
+  while ((opt = getopt(argc, argv, "nj:")) != -1) {
+    switch (opt) {
+    case 'n':
+      repair = 0;
+      break;
+    case 'j':
+      num_workers = atoi(optarg);
+      if (num_workers < 1) {
+        usage(argv[0]);
+        return FSCK_ERROR;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return FSCK_ERROR;
+    }
+  }
+  if (optind < argc - 1) {
+    usage(argv[0]);
+    return FSCK_ERROR;
+  }
+  const char* filename = optind < argc ? argv[optind] : DISK_FILENAME;
+
+  // raw_mount() would create a missing image
+  if (access(filename, repair ? R_OK | W_OK : R_OK) < 0) {
+    perror(filename);
+    return FSCK_ERROR;
+  }
+  // a repair takes the same exclusive lock as a mount, so it never runs
+  // while command_line or jfsd is using the image; a check only reads
+  if ((repair ? raw_mount(filename) : raw_mount_readonly(filename)) < 0) {
+    if (repair) {
+      fprintf(stderr, "%s: could not open the image; if it is mounted, unmount it or "
+                      "check it with -n\n", filename);
+    } else {
+      fprintf(stderr, "%s: could not open the image\n", filename);
+    }
+    return FSCK_ERROR;
+  }
+  if (read_image(num_workers) < 0) {
+    fprintf(stderr, "%s: could not read the image\n", filename);
+    raw_unmount();
+    return FSCK_ERROR;
+  }
+
+  struct superblock sb;
+  memcpy(&sb, image[SUPERBLOCK_BLOCK], sizeof(sb));
+  if (sb.magic != JFS_MAGIC) {
+    fprintf(stderr, "%s: not a formatted image\n", filename);
+    raw_unmount();
+    return FSCK_ERROR;
+  }
+  if (sb.version != JFS_VERSION || sb.num_blocks != NUM_BLOCKS) {
+    fprintf(stderr, "%s: unsupported version %u\n", filename, sb.version);
+    raw_unmount();
+    return FSCK_ERROR;
+  }
+  if (sb.state != FS_CLEAN) {
+    if (repair) {
+      // nobody else holds the lock, so the last mount ended without unmounting
+      printf("%s: image was not unmounted cleanly\n", filename);
+    } else {
+      printf("%s: image is mounted or was not unmounted cleanly\n", filename);
+    }
+  }
+
+  // checked first: the checks below trust the contents of every block
+  int bad_checksums[NUM_BLOCKS];
+  int num_bad_checksums = 0;
+  for (int b = 0; b < NUM_BLOCKS; b++) {
+    if (!raw_verify_block(b, image[b])) {
+      printf("block %d: does not match its checksum\n", b);
+      bad_checksums[num_bad_checksums++] = b;
+      num_problems++;
+    }
+  }
+
+  has_refcounts = sb.refcount_blocks[0] != 0;
+  walk_tree(sb.root_block);
+  mark_snapshots(&sb);
+  mark_refcounts(&sb);
+  int refcounts_changed = check_refcounts(&sb);
+
+  unsigned char* bitmap = (unsigned char*) image[BITMAP_BLOCK];
+  int free_blocks = check_bitmap(bitmap);
+  if (sb.state == FS_CLEAN && sb.free_blocks != free_blocks) {
+    printf("superblock: free block count %u, should be %d\n", sb.free_blocks, free_blocks);
+    num_problems++;
+  }
+
+  int ret = FSCK_OK;
+  if (num_problems > 0) {
+    ret = FSCK_UNCORRECTED;
+    if (repair) {
+      sb.free_blocks = free_blocks;
+      sb.state = FS_CLEAN;
+      memcpy(image[SUPERBLOCK_BLOCK], &sb, sizeof(sb));
+      if (write_block(BITMAP_BLOCK, image[BITMAP_BLOCK]) < 0 ||
+          write_block(SUPERBLOCK_BLOCK, image[SUPERBLOCK_BLOCK]) < 0) {
+        fprintf(stderr, "%s: could not write repairs\n", filename);
+        raw_unmount();
+        return FSCK_ERROR;
+      }
+      // rewriting a block gives it the checksum of what it holds now
+      for (int i = 0; i < num_bad_checksums; i++) {
+        if (write_block(bad_checksums[i], image[bad_checksums[i]]) < 0) {
+          fprintf(stderr, "%s: could not write repairs\n", filename);
+          raw_unmount();
+          return FSCK_ERROR;
+        }
+      }
+      for (int i = 0; refcounts_changed && i < REFCOUNT_BLOCKS; i++) {
+        if (write_block(sb.refcount_blocks[i], image[sb.refcount_blocks[i]]) < 0) {
+          fprintf(stderr, "%s: could not write repairs\n", filename);
+          raw_unmount();
+          return FSCK_ERROR;
+        }
+      }
+      ret = FSCK_REPAIRED;
+    }
+  }
+
+  printf("%s: %d problem(s)%s, %d/%d blocks free\n", filename, num_problems,
+         ret == FSCK_REPAIRED ? " repaired" : "", free_blocks, NUM_BLOCKS);
+  raw_unmount();
+  return ret;
+}
@@ -0,0 +1,579 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "jumbo_file_system.h"
+#include "jfsd.h"
+
+/* jfsd owns an image and serves jfs_* calls to local clients over a Unix
+ * socket (see jfsd.h; jfs_remote.c is the client side).  It is a single
+ * thread: every time some clients have requests ready, it runs all of them,
+ * one client after another, as one batch of the block cache, so blocks
+ * written by several requests (or several clients) reach the disk once.
+ * Replies are only sent after the batch is on the disk.
+ *
+ * The file system has a single current directory, so each client's is kept
+ * here as the names from the root and re-entered whenever the server
+ * switches clients.  If another client removes or renames one of those
+ * directories, the client ends up in the deepest one that is left.
+ */
+
+#define DISK_FILENAME "DISK"
+#define MAX_CLIENTS 64
+#define READ_CHUNK 65536 // most bytes taken from a client per read()
+
+enum client_state {
+  OPEN,
+  CLOSING, // no more requests will be read, but replies are still sent
+  BROKEN   // nothing more is read or sent
+};
+
+struct client {
+  int fd;
+  enum client_state state;
+  char* in;        // bytes received but not yet run as requests
+  size_t in_len;
+  size_t in_cap;
+  char* out;       // replies not yet sent
+  size_t out_len;
+  size_t out_cap;
+  size_t out_sent;
+  // the client's current directory: names from the root
+  char cwd[NUM_BLOCKS][MAX_NAME_LENGTH + 1];
+  int depth;
+};
+
+static struct client* clients[MAX_CLIENTS];
+static int num_clients = 0;
+
+// the client whose current directory the file system is in
+static struct client* current = NULL;
+
+static volatile sig_atomic_t stopping = 0;
+
+// strings each request needs (more are ignored)
+static const int min_strings[JFSD_NUM_OPS] = {
+  [JFSD_MKDIR] = 1, [JFSD_RMDIR] = 1, [JFSD_CREAT] = 1, [JFSD_REMOVE] = 1,
+  [JFSD_RENAME] = 2, [JFSD_STAT] = 1, [JFSD_WRITE] = 1, [JFSD_READ] = 1,
+  [JFSD_TRUNCATE] = 1, [JFSD_PUNCH_HOLE] = 1, [JFSD_REMOVE_TREE] = 1,
+  [JFSD_SNAPSHOT] = 1, [JFSD_ROLLBACK] = 1, [JFSD_DELETE_SNAPSHOT] = 1,
+};
+
+
+static void stop(int sig) {
+  (void) sig;
+  stopping = 1;
+}
+
+
+// makes room for needed more bytes in a growable buffer
+static int reserve(char** buf, size_t* cap, size_t len, size_t needed) {
+  if (len + needed <= *cap) {
+    return 0;
+  }
+  size_t new_cap = *cap > 0 ? *cap : 4096;
+  while (new_cap < len + needed) {
+    new_cap *= 2;
+  }
+  char* new_buf = realloc(*buf, new_cap);
+  if (NULL == new_buf) {
+    return -1;
+  }
+  *buf = new_buf;
+  *cap = new_cap;
+  return 0;
+}
+
+
+// adds bytes to the reply being built; on failure the client is dropped
+static void append(struct client* c, const void* data, size_t len) {
+  if (c->state == BROKEN) {
+    return;
+  }
+  if (reserve(&c->out, &c->out_cap, c->out_len, len) < 0) {
+    c->state = BROKEN; // its replies would be incomplete
+    return;
+  }
+  memcpy(c->out + c->out_len, data, len);
+  c->out_len += len;
+}
+
+
+static int append_entry(const char* path, const struct stats* st, void* arg) {
+  struct client* c = (struct client*) arg;
+  append(c, st, sizeof(*st));
+  append(c, path, strlen(path) + 1);
+  return 0;
+}
+
+
+/* enter
+ *   makes a client's current directory the file system's
+ */
+static void enter(struct client* c) {
+  if (current == c) {
+    return;
+  }
+  current = c;
+  jfs_chdir(NULL);
+  for (int i = 0; i < c->depth; i++) {
+    if (jfs_chdir(c->cwd[i]) != E_SUCCESS) {
+      c->depth = i;
+      break;
+    }
+  }
+}
+
+
+/* get_strings
+ *   splits the start of a request's body into '\0'-terminated strings
+ * names - set to the strings found (NULL after the last one)
+ * max - how many strings to look for
+ * returns the number of bytes the strings take up
+ */
+static size_t get_strings(const char* body, size_t len, const char* names[], int max) {
+  size_t pos = 0;
+  for (int i = 0; i < max; i++) {
+    names[i] = NULL;
+    const char* end = pos < len ? memchr(body + pos, '\0', len - pos) : NULL;
+    if (NULL != end) {
+      names[i] = body + pos;
+      pos = end - body + 1;
+    }
+  }
+  return pos;
+}
+
+
+/* serve
+ *   runs one request and adds its reply to the client's replies
+ */
+static void serve(struct client* c, const struct jfsd_request* req, const char* body) {
+  enter(c);
+
+  const char* names[2];
+  size_t names_len = get_strings(body, req->length, names, 2);
+  const char* data = body + names_len;
+  size_t data_len = req->length - names_len;
+
+  size_t start = c->out_len;
+  struct jfsd_reply reply = {0, E_INVALID};
+  append(c, &reply, sizeof(reply));
+
+  // a request missing strings it needs runs as no operation at all
+  int op = req->op;
+  if ((NULL == names[0] && min_strings[op] > 0) ||
+      (NULL == names[1] && min_strings[op] > 1)) {
+    op = JFSD_NUM_OPS;
+  }
+
+  int ret = E_INVALID;
+  switch (op) {
+  case JFSD_MKDIR:
+    ret = jfs_mkdir(names[0]);
+    break;
+  case JFSD_CHDIR:
+    ret = jfs_chdir(names[0]);
+    if (ret == E_SUCCESS && NULL == names[0]) {
+      c->depth = 0;
+    } else if (ret == E_SUCCESS) {
+      strcpy(c->cwd[c->depth++], names[0]);
+    }
+    break;
+  case JFSD_LS: {
+    char names[LS_PACKED_SIZE];
+    int num_directories, num_files;
+    ret = jfs_ls_packed(names, &num_directories, &num_files);
+    if (ret == E_SUCCESS) {
+      // the names are already packed; each list ends in ""
+      const char* name = names;
+      for (int i = 0; i < num_directories; i++) {
+        name += strlen(name) + 1;
+      }
+      append(c, names, name - names);
+      append(c, "", 1);
+      const char* files = name;
+      for (int i = 0; i < num_files; i++) {
+        name += strlen(name) + 1;
+      }
+      append(c, files, name - files);
+      append(c, "", 1);
+    }
+    break;
+  }
+  case JFSD_RMDIR:
+    ret = jfs_rmdir(names[0]);
+    break;
+  case JFSD_CREAT:
+    ret = jfs_creat(names[0]);
+    break;
+  case JFSD_REMOVE:
+    ret = jfs_remove(names[0]);
+    break;
+  case JFSD_RENAME:
+    ret = jfs_rename(names[0], names[1]);
+    break;
+  case JFSD_STAT: {
+    struct stats st;
+    ret = jfs_stat(names[0], &st);
+    if (ret == E_SUCCESS) {
+      append(c, &st, sizeof(st));
+    }
+    break;
+  }
+  case JFSD_WRITE:
+    if (data_len <= 0xffff) {
+      ret = jfs_write(names[0], data, data_len);
+    }
+    break;
+  case JFSD_READ: {
+    unsigned short count = req->arg[0];
+    if (reserve(&c->out, &c->out_cap, c->out_len, count) < 0) {
+      c->state = BROKEN;
+      break;
+    }
+    ret = jfs_read(names[0], c->out + c->out_len, &count);
+    if (ret == E_SUCCESS) {
+      c->out_len += count;
+    }
+    break;
+  }
+  case JFSD_TRUNCATE:
+    ret = jfs_truncate(names[0], req->arg[0]);
+    break;
+  case JFSD_PUNCH_HOLE:
+    ret = jfs_punch_hole(names[0], req->arg[0], req->arg[1]);
+    break;
+  case JFSD_REMOVE_TREE:
+    ret = jfs_remove_tree(names[0]);
+    break;
+  case JFSD_DU: {
+    struct du_stats usage;
+    ret = jfs_du(names[0], &usage);
+    if (ret == E_SUCCESS) {
+      append(c, &usage, sizeof(usage));
+    }
+    break;
+  }
+  case JFSD_WALK:
+    ret = jfs_walk(append_entry, c);
+    break;
+  case JFSD_STATFS: {
+    struct fs_stats st;
+    ret = jfs_statfs(&st);
+    if (ret == E_SUCCESS) {
+      append(c, &st, sizeof(st));
+    }
+    break;
+  }
+  case JFSD_SNAPSHOT:
+    ret = jfs_snapshot(names[0]);
+    break;
+  case JFSD_ROLLBACK:
+    ret = jfs_rollback(names[0]);
+    if (ret == E_SUCCESS) {
+      c->depth = 0;
+    }
+    break;
+  case JFSD_DELETE_SNAPSHOT:
+    ret = jfs_delete_snapshot(names[0]);
+    break;
+  case JFSD_LIST_SNAPSHOTS: {
+    char* snapshot_names[MAX_SNAPSHOTS + 1];
+    ret = jfs_list_snapshots(snapshot_names);
+    if (ret == E_SUCCESS) {
+      for (int i = 0; NULL != snapshot_names[i]; i++) {
+        append(c, snapshot_names[i], strlen(snapshot_names[i]) + 1);
+        free(snapshot_names[i]);
+      }
+      append(c, "", 1);
+    }
+    break;
+  }
+  case JFSD_SET_DEDUP:
+    ret = jfs_set_dedup(req->arg[0]);
+    break;
+  case JFSD_SET_COMPRESSION:
+    ret = jfs_set_compression(req->arg[0]);
+    break;
+  case JFSD_SET_CHECKSUMS:
+    ret = jfs_set_checksums(req->arg[0]);
+    break;
+  case JFSD_PRINT_STATS: {
+    char* text = NULL;
+    size_t text_len = 0;
+    FILE* out = open_memstream(&text, &text_len);
+    if (NULL == out) {
+      ret = E_UNKNOWN;
+      break;
+    }
+    ret = jfs_print_stats(out, req->arg[0]);
+    fclose(out);
+    append(c, text, text_len);
+    free(text);
+    break;
+  }
+  case JFSD_RESET_STATS:
+    ret = jfs_reset_stats();
+    break;
+  }
+
+  reply.ret = ret;
+  if (c->state != BROKEN) {
+    reply.length = c->out_len - start - sizeof(reply);
+    memcpy(c->out + start, &reply, sizeof(reply));
+  }
+}
+
+
+/* receive
+ *   reads what a client has sent and runs every complete request in it
+ */
+static void receive(struct client* c) {
+  if (reserve(&c->in, &c->in_cap, c->in_len, READ_CHUNK) < 0) {
+    c->state = BROKEN;
+    return;
+  }
+  ssize_t n = read(c->fd, c->in + c->in_len, READ_CHUNK);
+  if (n <= 0) {
+    c->state = CLOSING;
+    return;
+  }
+  c->in_len += n;
+
+  size_t pos = 0;
+  while (c->in_len - pos >= sizeof(struct jfsd_request) && c->state != BROKEN) {
+    struct jfsd_request req;
+    memcpy(&req, c->in + pos, sizeof(req));
+    if (req.length > JFSD_MAX_REQUEST || req.op >= JFSD_NUM_OPS) {
+      c->state = BROKEN;
+      break;
+    }
+    if (c->in_len - pos < sizeof(req) + req.length) {
+      break;
+    }
+    serve(c, &req, c->in + pos + sizeof(req));
+    pos += sizeof(req) + req.length;
+  }
+  memmove(c->in, c->in + pos, c->in_len - pos);
+  c->in_len -= pos;
+}
+
+
+/* flush_replies
+ *   sends as much of a client's replies as it will take without waiting
+ */
+static void flush_replies(struct client* c) {
+  while (c->out_sent < c->out_len && c->state != BROKEN) {
+    ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    } else if (n <= 0) {
+      c->state = BROKEN;
+      return;
+    }
+    c->out_sent += n;
+  }
+  c->out_len = c->out_sent = 0;
+}
+
+
+static void add_client(int fd) {
+  struct client* c = calloc(1, sizeof(struct client));
+  if (num_clients == MAX_CLIENTS || NULL == c) {
+    fprintf(stderr, "jfsd: too many clients\n");
+    free(c);
+    close(fd);
+    return;
+  }
+  c->fd = fd;
+  clients[num_clients++] = c;
+}
+
+
+static void remove_client(int i) {
+  struct client* c = clients[i];
+  if (current == c) {
+    current = NULL;
+  }
+  close(c->fd);
+  free(c->in);
+  free(c->out);
+  free(c);
+  clients[i] = clients[--num_clients];
+}
+
+
+/* open_socket
+ *   listens on a Unix socket, replacing a stale socket file left by a server
+ *   that is no longer running
+ */
+static int open_socket(const char* path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "jfsd: %s: socket path too long\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 && errno == EADDRINUSE) {
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    int alive = connect(probe, (struct sockaddr*) &addr, sizeof(addr)) == 0;
+    close(probe);
+    if (alive) {
+      fprintf(stderr, "jfsd: %s: another server is running\n", path);
+      close(fd);
+      return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+      perror(path);
+      close(fd);
+      return -1;
+    }
+  }
+  if (listen(fd, MAX_CLIENTS) < 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+void usage(const char* name) {
+  fprintf(stderr, "usage: %s [-f disk_file] [-s stats_file] [-t trace_file] [socket]\n", name);
+  fprintf(stderr, "  serves the image to jfs clients until interrupted\n");
+  fprintf(stderr, "  -f  image to serve (default %s)\n", DISK_FILENAME);
+  fprintf(stderr, "  -s  write the per-operation stats to stats_file as JSON on exit\n");
+  fprintf(stderr, "  -t  record every file system call to trace_file, for jfs_replay\n");
+  fprintf(stderr, "  socket  path to listen on (default disk_file%s)\n", JFSD_SOCKET_SUFFIX);
+}
+
+
+int main(int argc, char* argv[]) {
+  const char* filename = DISK_FILENAME;
+  const char* stats_filename = NULL;
+  const char* trace_filename = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:s:t:")) != -1) {
+    if ('f' == opt) {
+      filename = optarg;
+    } else if ('s' == opt) {
+      stats_filename = optarg;
+    } else if ('t' == opt) {
+      trace_filename = optarg;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (optind < argc - 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  char socket_path[PATH_MAX];
+  if (optind == argc - 1) {
+    snprintf(socket_path, sizeof(socket_path), "%s", argv[optind]);
+  } else {
+    snprintf(socket_path, sizeof(socket_path), "%s%s", filename, JFSD_SOCKET_SUFFIX);
+  }
+
+  // on before mounting, so the blocks used last time are prefetched
+  raw_set_cache(1);
+  if (jfs_mount(filename) < 0) {
+    fprintf(stderr, "jfsd: could not mount %s\n", filename);
+    return 1;
+  }
+  jfs_set_stats_file(stats_filename);
+  if (NULL != trace_filename && jfs_set_trace_file(trace_filename) != E_SUCCESS) {
+    fprintf(stderr, "jfsd: could not record a trace to %s\n", trace_filename);
+    jfs_unmount();
+    return 1;
+  }
+  int listen_fd = open_socket(socket_path);
+  if (listen_fd < 0) {
+    jfs_unmount();
+    return 1;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  struct pollfd fds[MAX_CLIENTS + 1];
+  while (!stopping) {
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+    for (int i = 0; i < num_clients; i++) {
+      fds[i + 1].fd = clients[i]->fd;
+      fds[i + 1].events = clients[i]->out_len > 0 ? POLLOUT : POLLIN;
+    }
+    int num_fds = num_clients + 1;
+    if (poll(fds, num_fds, -1) < 0) {
+      if (errno != EINTR) {
+        perror("poll");
+        break;
+      }
+      continue;
+    }
+
+    // run every request that has arrived as one batch
+    size_t queued[MAX_CLIENTS]; // replies queued before the batch
+    raw_begin_batch();
+    for (int i = 0; i < num_fds - 1; i++) {
+      queued[i] = clients[i]->out_len;
+      if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+        receive(clients[i]);
+      }
+    }
+    if (raw_end_batch() < 0) {
+      // the replies of this batch would claim writes that never reached the
+      // disk; its clients are dropped instead, so their calls fail
+      fprintf(stderr, "jfsd: could not write to %s\n", filename);
+      for (int i = 0; i < num_fds - 1; i++) {
+        if (clients[i]->out_len > queued[i]) {
+          clients[i]->state = BROKEN;
+        }
+      }
+    }
+
+    for (int i = num_clients - 1; i >= 0; i--) {
+      flush_replies(clients[i]);
+      if (clients[i]->state == BROKEN ||
+          (clients[i]->state == CLOSING && clients[i]->out_len == 0)) {
+        remove_client(i);
+      }
+    }
+    if (fds[0].revents & POLLIN) {
+      int fd = accept(listen_fd, NULL, NULL);
+      if (fd >= 0) {
+        add_client(fd);
+      }
+    }
+  }
+
+  while (num_clients > 0) {
+    remove_client(num_clients - 1);
+  }
+  close(listen_fd);
+  unlink(socket_path);
+  return jfs_unmount() < 0;
+}
@@ -0,0 +1,64 @@
+#ifndef _JFSD_H_
+#define _JFSD_H_
+
+#include <stdint.h>
+
+/* Protocol between jfsd and its clients (jfs_remote.c), over a Unix stream
+ * socket.  A client sends requests and reads one reply per request, in
+ * order; it may send several requests before reading their replies.  Both
+ * sides run on the same machine, so structs are sent as they are in memory.
+ *
+ * A request is a struct jfsd_request followed by its strings (each ending in
+ * '\0') and then its data.  A reply is a struct jfsd_reply followed by its
+ * data, described below for each request that has any.
+ */
+
+// appended to the image's name to get the default socket path
+#define JFSD_SOCKET_SUFFIX ".sock"
+
+// longest request the server accepts, not counting the header
+#define JFSD_MAX_REQUEST (1 << 17)
+
+// requests, with their strings and arguments; each one calls the jfs_*
+// function of the same name in the client's current directory
+enum jfsd_op {
+  JFSD_MKDIR,           // name
+  JFSD_CHDIR,           // name, or no string for the root directory
+  JFSD_LS,              // reply: directory names, "", file names, ""
+  JFSD_RMDIR,           // name
+  JFSD_CREAT,           // name
+  JFSD_REMOVE,          // name
+  JFSD_RENAME,          // old path, new path
+  JFSD_STAT,            // name; reply: struct stats
+  JFSD_WRITE,           // name, then the data
+  JFSD_READ,            // name; arg[0] = buffer size; reply: the data
+  JFSD_TRUNCATE,        // name; arg[0] = size
+  JFSD_PUNCH_HOLE,      // name; arg[0] = offset, arg[1] = length
+  JFSD_REMOVE_TREE,     // name
+  JFSD_DU,              // name, or no string; reply: struct du_stats
+  JFSD_WALK,            // reply: a struct stats and a path for each entry
+  JFSD_STATFS,          // reply: struct fs_stats
+  JFSD_SNAPSHOT,        // name
+  JFSD_ROLLBACK,        // name
+  JFSD_DELETE_SNAPSHOT, // name
+  JFSD_LIST_SNAPSHOTS,  // reply: snapshot names, ""
+  JFSD_SET_DEDUP,       // arg[0] = enable
+  JFSD_SET_COMPRESSION, // arg[0] = enable
+  JFSD_SET_CHECKSUMS,   // arg[0] = enable
+  JFSD_PRINT_STATS,     // arg[0] = json; reply: the text
+  JFSD_RESET_STATS,
+  JFSD_NUM_OPS
+};
+
+struct jfsd_request {
+  uint32_t length; // bytes of strings and data after the header
+  uint32_t op;     // one of the JFSD_* values
+  uint16_t arg[2]; // numeric arguments
+};
+
+struct jfsd_reply {
+  uint32_t length; // bytes of data after the header
+  int32_t ret;     // what the jfs_* function returned
+};
+
+#endif // _JFSD_H_
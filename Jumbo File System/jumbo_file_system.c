@@ -1,4 +1,8 @@
 #include "jumbo_file_system.h"
+#include "lz.h"
+#include "op_stats.h"
+#include "trace.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +15,36 @@ typedef char bool_t;
 
 static block_num_t current_dir;
 
+// directory blocks from the root (dir_path[0]) down to the current directory
+// (dir_path[dir_depth]); needed to copy a directory's ancestors when a
+// snapshot shares them
+static block_num_t dir_path[NUM_BLOCKS];
+static int dir_depth;
+
+// whether jfs_chdir() prefetches the blocks of the new directory's entries
+// (see jfs_set_prefetch())
+static bool_t prefetch_on = FALSE;
+
+// file where jfs_unmount() writes the per-operation counters, or NULL
+static char *stats_filename;
+
+// fingerprint index for dedup: maps the hash of a full data block in the live
+// tree to the block.  It is a cache (a slot is simply overwritten on a
+// collision), so it may miss duplicates but never returns a wrong block;
+// dedup_slot_of[b] is 1 + the slot holding block b, or 0.
+#define DEDUP_SLOTS (2 * NUM_BLOCKS)
+static struct
+{
+  uint32_t hash;
+  block_num_t block_num;
+} dedup_index[DEDUP_SLOTS];
+static uint16_t dedup_slot_of[NUM_BLOCKS];
+
+// blocks jfs_remove_tree() collects before releasing them: every inode may
+// list MAX_DATA_BLOCKS data blocks (shared ones more than once, with dedup).
+// Too big for the stack, and kept here rather than malloced on every call.
+static block_num_t removed_blocks[NUM_BLOCKS * (MAX_DATA_BLOCKS + 1)];
+
 // optional helper function you can implement to tell you if a block is a dir node or an inode
 static bool_t is_dir(block_num_t block_num)
 {
@@ -40,6 +74,7 @@ static int set_dir(block_num_t block_num, int isdir)
   }
   struct block *blk = (struct block *)buf;
   blk->is_dir = isdir;
+  blk->flags = 0;
   if (isdir == dir)
   {
     (blk->contents).dirnode.num_entries = 0;
@@ -47,6 +82,11 @@ static int set_dir(block_num_t block_num, int isdir)
   else
   {
     (blk->contents).inode.file_size = 0;
+    (blk->contents).inode.stored_size = 0;
+    if (bfs_has_feature(FEATURE_COMPRESS))
+    {
+      blk->flags |= INODE_COMPRESSED;
+    }
   }
   if (write_block(block_num, (void *)blk) < 0)
   {
@@ -74,25 +114,448 @@ static bool_t is_dir_empty(block_num_t block_num)
   }
 }
 
+// number of bytes of data stored for a file: its compressed size, or its size
+// if the data is stored as is
+static int stored_bytes(struct block *blk)
+{
+  if ((blk->flags & INODE_COMPRESSED) && (blk->contents).inode.stored_size != 0)
+  {
+    return (blk->contents).inode.stored_size;
+  }
+  return (blk->contents).inode.file_size;
+}
+
+// number of entries of data_blocks a file uses (0 if its data is stored
+// inline); an entry is 0 for a hole (see jfs_punch_hole())
+static int num_data_blocks(struct block *blk)
+{
+  int size = stored_bytes(blk);
+  if (size <= (int)MAX_INLINE_SIZE)
+  {
+    return 0;
+  }
+  return (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+// number of data blocks a file actually has, not counting holes
+static int num_allocated_blocks(struct block *blk)
+{
+  int num_data = num_data_blocks(blk);
+  int count = 0;
+  int bk;
+  for (bk = 0; bk < num_data; bk++)
+  {
+    if ((blk->contents).inode.data_blocks[bk] != 0)
+    {
+      count++;
+    }
+  }
+  return count;
+}
+
+// copies the stored data of a file (see stored_bytes()) to out
+static int load_data(struct block *blk, char *out)
+{
+  int size = stored_bytes(blk);
+  int num_data = num_data_blocks(blk);
+  if (num_data == 0)
+  {
+    memcpy(out, (blk->contents).inode.data, size);
+    return E_SUCCESS;
+  }
+  int bk;
+  for (bk = 0; bk < num_data; bk++)
+  {
+    char read_buf[BLOCK_SIZE];
+    if (read_block((blk->contents).inode.data_blocks[bk], read_buf) < 0)
+    {
+      return E_UNKNOWN;
+    }
+    int len = size - bk * BLOCK_SIZE < BLOCK_SIZE ? size - bk * BLOCK_SIZE : BLOCK_SIZE;
+    memcpy(out + bk * BLOCK_SIZE, read_buf, len);
+  }
+  return E_SUCCESS;
+}
+
+// copies the (decompressed) contents of a compressed file to out, which must
+// have room for MAX_FILE_SIZE bytes
+static int unpack_data(struct block *blk, char *out)
+{
+  if ((blk->contents).inode.stored_size == 0)
+  {
+    return load_data(blk, out);
+  }
+  char packed[MAX_FILE_SIZE];
+  int ret = load_data(blk, packed);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  int len = lz_decompress(packed, (blk->contents).inode.stored_size, out, MAX_FILE_SIZE);
+  if (len != (blk->contents).inode.file_size)
+  {
+    return E_UNKNOWN;
+  }
+  return E_SUCCESS;
+}
+
+// returns the index of the entry with the given name in a directory block, or
+// -1 if there is none
+static int find_entry(struct block *blk, const char *name)
+{
+  int i;
+  for (i = 0; i < (blk->contents).dirnode.num_entries; i++)
+  {
+    if (strcmp((blk->contents).dirnode.entries[i].name, name) == 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// fills in the stats of a file or directory from its block
+static void fill_stats(struct stats *buf, const char *name, block_num_t block_num, struct block *blk)
+{
+  buf->block_num = block_num;
+  strcpy(buf->name, name);
+  if (blk->is_dir == dir)
+  {
+    buf->is_dir = dir;
+    return;
+  }
+  buf->is_dir = file;
+  buf->file_size = (blk->contents).inode.file_size;
+  buf->physical_size = stored_bytes(blk);
+  buf->num_data_blocks = num_allocated_blocks(blk); // 0 if stored inline
+  int num_data = num_data_blocks(blk);
+  int bk;
+  for (bk = 0; bk < num_data; bk++)
+  {
+    if ((blk->contents).inode.data_blocks[bk] == 0)
+    {
+      // nothing is stored for a hole
+      int size = stored_bytes(blk);
+      buf->physical_size -= size - bk * BLOCK_SIZE < BLOCK_SIZE ? size - bk * BLOCK_SIZE : BLOCK_SIZE;
+    }
+  }
+}
+
+/* traverse
+ *   calls visit() for a block and then, if it is a directory, for everything
+ *   below it, depth first; every block is read exactly once
+ * path - buffer of MAX_PATH_LENGTH + 1 bytes holding the path of the block
+ *   (path_len bytes); it is extended in place for the blocks below
+ * returns 0, or the first value other than 0 returned by visit()
+ */
+typedef int (*visit_fn)(block_num_t block_num, struct block *blk, const char *path, void *arg);
+
+static int traverse(block_num_t block_num, char *path, int path_len, visit_fn visit, void *arg)
+{
+  char buf[BLOCK_SIZE];
+  if (read_block(block_num, buf) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  struct block *blk = (struct block *)buf;
+  int ret = visit(block_num, blk, path, arg);
+  if (ret != 0 || blk->is_dir != dir)
+  {
+    return ret;
+  }
+
+  int i;
+  for (i = 0; i < (blk->contents).dirnode.num_entries; i++)
+  {
+    const char *name = (blk->contents).dirnode.entries[i].name;
+    int len = path_len;
+    if (len > 0)
+    {
+      path[len++] = '/';
+    }
+    if (len + strlen(name) > MAX_PATH_LENGTH)
+    {
+      return E_UNKNOWN; // only possible if the tree has a cycle
+    }
+    strcpy(path + len, name);
+    ret = traverse((blk->contents).dirnode.entries[i].block_num, path, len + strlen(name), visit, arg);
+    path[path_len] = '\0';
+    if (ret != 0)
+    {
+      return ret;
+    }
+  }
+  return 0;
+}
+
+// FNV-1a hash of a data block
+static uint32_t dedup_hash(const void *data)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  uint32_t hash = 2166136261u;
+  int i;
+  for (i = 0; i < BLOCK_SIZE; i++)
+  {
+    hash = (hash ^ p[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static void dedup_reset()
+{
+  memset(dedup_index, 0, sizeof(dedup_index));
+  memset(dedup_slot_of, 0, sizeof(dedup_slot_of));
+}
+
+// removes a block from the index, e.g. because it left the live tree
+static void dedup_forget(block_num_t block_num)
+{
+  if (dedup_slot_of[block_num] != 0)
+  {
+    dedup_index[dedup_slot_of[block_num] - 1].block_num = 0;
+    dedup_slot_of[block_num] = 0;
+  }
+}
+
+// records the contents of a full data block that was just written
+static void dedup_insert(const void *data, block_num_t block_num)
+{
+  if (!bfs_has_feature(FEATURE_DEDUP))
+  {
+    return;
+  }
+  uint32_t hash = dedup_hash(data);
+  int slot = hash % DEDUP_SLOTS;
+  dedup_forget(dedup_index[slot].block_num);
+  dedup_forget(block_num);
+  dedup_index[slot].hash = hash;
+  dedup_index[slot].block_num = block_num;
+  dedup_slot_of[block_num] = slot + 1;
+}
+
+// returns a live data block holding exactly the given full block of data
+// that can take another reference, or 0 if there is none (or dedup is off)
+static block_num_t dedup_find(const void *data)
+{
+  if (!bfs_has_feature(FEATURE_DEDUP))
+  {
+    return 0;
+  }
+  uint32_t hash = dedup_hash(data);
+  int slot = hash % DEDUP_SLOTS;
+  block_num_t found = dedup_index[slot].block_num;
+  if (found == 0 || dedup_index[slot].hash != hash || bfs_refcount(found) == MAX_REFCOUNT)
+  {
+    return 0;
+  }
+  // a hash match is only a hint; compare the contents
+  char found_buf[BLOCK_SIZE];
+  if (read_block(found, found_buf) < 0 || memcmp(found_buf, data, BLOCK_SIZE) != 0)
+  {
+    return 0;
+  }
+  return found;
+}
+
+// recounts the references to every data block of the live tree and replaces
+// the reference count table (needed after a rollback changes the tree)
+static int recount_refs()
+{
+  unsigned char refs[NUM_BLOCKS];
+  block_num_t stack[NUM_BLOCKS];
+  int seen[NUM_BLOCKS];
+  int top = 0;
+  memset(seen, 0, sizeof(seen));
+  memset(refs, 0, sizeof(refs));
+  stack[top++] = bfs_root();
+  while (top > 0)
+  {
+    char buf[BLOCK_SIZE];
+    if (read_block(stack[--top], buf) < 0)
+    {
+      return E_UNKNOWN;
+    }
+    struct block *blk = (struct block *)buf;
+    int i;
+    if (blk->is_dir == dir)
+    {
+      for (i = 0; i < (blk->contents).dirnode.num_entries; i++)
+      {
+        stack[top++] = (blk->contents).dirnode.entries[i].block_num;
+      }
+    }
+    else
+    {
+      int num_data = num_data_blocks(blk);
+      for (i = 0; i < num_data; i++)
+      {
+        block_num_t data_block = (blk->contents).inode.data_blocks[i];
+        // the first reference is not counted
+        if (data_block != 0 && seen[data_block]++ > 0)
+        {
+          refs[data_block]++;
+        }
+      }
+    }
+  }
+  return bfs_set_refcounts(refs) < 0 ? E_UNKNOWN : E_SUCCESS;
+}
+
+// drops one reference to a block of the live tree
+static int drop_block(block_num_t block_num)
+{
+  if (bfs_refcount(block_num) == 0)
+  {
+    dedup_forget(block_num);
+  }
+  return release_block(block_num);
+}
+
+// returns TRUE if write_cow() would have to copy the block
+static bool_t must_copy(block_num_t block_num)
+{
+  return bfs_is_frozen(block_num) || bfs_refcount(block_num) > 0;
+}
+
+/* write_cow
+ *   writes a block, unless the block is shared with a snapshot or by dedup;
+ *   then the data is written to a newly allocated block instead, the old
+ *   block is released (the snapshot or the other files keep it) and
+ *   *block_num is changed to the new block, so the caller must update
+ *   whatever points to it
+ */
+static int write_cow(block_num_t *block_num, void *buf)
+{
+  if (must_copy(*block_num))
+  {
+    block_num_t copy = allocate_block();
+    if (copy == 0)
+    {
+      return E_DISK_FULL;
+    }
+    if (drop_block(*block_num) < 0)
+    {
+      return E_UNKNOWN;
+    }
+    *block_num = copy;
+  }
+  if (write_block(*block_num, buf) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  return E_SUCCESS;
+}
+
+// writes the directory block at path[level], where path lists directory
+// blocks from the root down, copying it (and then its ancestors, up to the
+// root) if a snapshot shares it; the current directory's path is kept up to
+// date when it includes a copied block
+static int write_path(block_num_t *path, int level, void *buf)
+{
+  block_num_t old = path[level];
+  int ret = write_cow(&path[level], buf);
+  if (ret < 0 || path[level] == old)
+  {
+    return ret;
+  }
+  int k;
+  for (k = 0; k <= dir_depth; k++)
+  {
+    if (dir_path[k] == old)
+    {
+      dir_path[k] = path[level];
+    }
+  }
+  current_dir = dir_path[dir_depth];
+  if (level == 0)
+  {
+    return bfs_set_root(path[0]) < 0 ? E_UNKNOWN : E_SUCCESS;
+  }
+
+  // point the parent's entry at the copy
+  char parent_buf[BLOCK_SIZE];
+  if (read_block(path[level - 1], parent_buf) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  struct block *parent = (struct block *)parent_buf;
+  int i;
+  for (i = 0; i < (parent->contents).dirnode.num_entries; i++)
+  {
+    if ((parent->contents).dirnode.entries[i].block_num == old)
+    {
+      (parent->contents).dirnode.entries[i].block_num = path[level];
+    }
+  }
+  return write_path(path, level - 1, parent_buf);
+}
+
+// writes the current directory block
+static int write_dir(void *buf)
+{
+  return write_path(dir_path, dir_depth, buf);
+}
+
+// writes the inode of entry i of the current directory, whose block is in
+// dir_buf; the directory is rewritten too if the inode has to be copied
+static int write_inode(void *dir_buf, int i, void *buf)
+{
+  struct block *blk = (struct block *)dir_buf;
+  block_num_t *inode = &(blk->contents).dirnode.entries[i].block_num;
+  block_num_t old = *inode;
+  int ret = write_cow(inode, buf);
+  if (ret < 0 || *inode == old)
+  {
+    return ret;
+  }
+  return write_dir(dir_buf);
+}
+
+// number of blocks copy-on-write may need to update an inode in the current
+// directory (the inode, its last data block and each directory up to the root)
+static int cow_reserve()
+{
+  if (bfs_num_snapshots() == 0)
+  {
+    return 0;
+  }
+  return dir_depth + 3;
+}
+
 /* jfs_mount
  *   prepares the DISK file on the _real_ file system to have file system
  *   blocks read and written to it.  The application _must_ call this function
  *   exactly once before calling any other jfs_* functions.  If your code
  *   requires any additional one-time initialization before any other jfs_*
- *   functions are called, you can add it here.
+ *   functions are called, you can add it here.  The root directory is only
+ *   initialized when the image is freshly formatted; mounting an existing
+ *   image keeps its contents.
  * filename - the name of the DISK file on the _real_ file system
  * returns 0 on success or -1 on error; errors should only occur due to
- *   errors in the underlying disk syscalls.
+ *   errors in the underlying disk syscalls (or an incompatible image, or a
+ *   file that is neither a JFS image nor empty, which is never formatted
+ *   over).  After an error the image is not mounted.
  */
 int jfs_mount(const char *filename)
 {
   int ret = bfs_mount(filename);
-  current_dir = 1;
-  if (set_dir(current_dir, 0) < 0)
+  if (ret < 0)
   {
     return E_UNKNOWN;
   }
-  return ret;
+  dir_depth = 0;
+  current_dir = dir_path[0] = bfs_root();
+  dedup_reset();
+  if (ret == 1)
+  {
+    // fresh image: the root directory starts out empty
+    if (set_dir(current_dir, dir) < 0)
+    {
+      raw_unmount();
+      return E_UNKNOWN;
+    }
+  }
+  return E_SUCCESS;
 }
 
 /* jfs_mkdir
@@ -101,19 +564,8 @@ int jfs_mount(const char *filename)
  * returns 0 on success or one of the following error codes on failure:
  *   E_EXISTS, E_MAX_NAME_LENGTH, E_MAX_DIR_ENTRIES, E_DISK_FULL
  */
-int jfs_mkdir(const char *directory_name)
+static int do_mkdir(const char *directory_name)
 {
-  // allocate a block and set dir=1
-  block_num_t next_dir = allocate_block();
-  if (next_dir == 0)
-  {
-    return E_DISK_FULL;
-  }
-  if (set_dir(next_dir, 0) < 0)
-  {
-    return E_UNKNOWN;
-  }
-
   // read the current dir block
   char buf[BLOCK_SIZE];
   if (read_block(current_dir, buf) < 0)
@@ -140,29 +592,50 @@ int jfs_mkdir(const char *directory_name)
       return E_EXISTS;
     }
   }
+  if (strlen(directory_name) > MAX_NAME_LENGTH)
+  {
+    return E_MAX_NAME_LENGTH;
+  }
 
-  // set block_num
-  (blk->contents).dirnode.entries[num_entries].block_num = next_dir;
-  // set dir name
-  int point = 0;
-  while (*(directory_name + point) != '\0')
+  // allocate the new directory's block only after the checks above, so that
+  // a failed mkdir does not leak it
+  block_num_t next_dir = allocate_block();
+  if (next_dir == 0)
   {
-    if (point >= MAX_NAME_LENGTH)
-    {
-      return E_MAX_NAME_LENGTH;
-    }
-    (blk->contents).dirnode.entries[num_entries].name[point] = *(directory_name + point);
-    point++;
+    return E_DISK_FULL;
+  }
+  if (set_dir(next_dir, 0) < 0)
+  {
+    release_block(next_dir);
+    return E_UNKNOWN;
   }
-  (blk->contents).dirnode.entries[num_entries].name[point] = '\0';
+
+  // set block_num and dir name
+  (blk->contents).dirnode.entries[num_entries].block_num = next_dir;
+  strcpy((blk->contents).dirnode.entries[num_entries].name, directory_name);
   // increase num_entries
   (blk->contents).dirnode.num_entries += 1;
 
-  if (write_block(current_dir, (void *)blk) < 0)
+  return write_dir(blk);
+}
+
+// starts reading the block of every entry of a directory into the block
+// cache, so that a following ls or stat finds them there
+static void prefetch_entries(block_num_t dir_block)
+{
+  char buf[BLOCK_SIZE];
+  if (read_block(dir_block, buf) < 0)
   {
-    return E_UNKNOWN;
+    return;
   }
-  return E_SUCCESS;
+  struct block *blk = (struct block *)buf;
+  block_num_t blocks[MAX_DIR_ENTRIES];
+  int i;
+  for (i = 0; i < (blk->contents).dirnode.num_entries; i++)
+  {
+    blocks[i] = (blk->contents).dirnode.entries[i].block_num;
+  }
+  raw_prefetch(blocks, i);
 }
 
 /* jfs_chdir
@@ -174,12 +647,17 @@ int jfs_mkdir(const char *directory_name)
  * returns 0 on success or one of the following error codes on failure:
  *   E_NOT_EXISTS, E_NOT_DIR
  */
-int jfs_chdir(const char *directory_name)
+static int do_chdir(const char *directory_name)
 {
   if (directory_name == NULL)
   {
     // go back to root directory
-    current_dir = 1;
+    dir_depth = 0;
+    current_dir = dir_path[0] = bfs_root();
+    if (prefetch_on == TRUE)
+    {
+      prefetch_entries(current_dir);
+    }
     return E_SUCCESS;
   }
   // read the current dir block
@@ -207,7 +685,11 @@ int jfs_chdir(const char *directory_name)
       }
       else
       {
-        current_dir = temp;
+        current_dir = dir_path[++dir_depth] = temp;
+        if (prefetch_on == TRUE)
+        {
+          prefetch_entries(current_dir);
+        }
         return E_SUCCESS;
       }
     }
@@ -216,20 +698,18 @@ int jfs_chdir(const char *directory_name)
   return E_NOT_EXISTS;
 }
 
-/* jfs_ls
+/* jfs_ls_packed
  *   finds the names of all the files and directories in the current directory
- *   and writes the directory names to the directories argument and the file
- *   names to the files argument
- * directories - array of strings; the function will set the strings in the
- *   array, followed by a NULL pointer after the last valid string; the strings
- *   should be malloced and the caller will free them
- * file - array of strings; the function will set the strings in the
- *   array, followed by a NULL pointer after the last valid string; the strings
- *   should be malloced and the caller will free them
+ *   and writes them one after another to a single buffer: first the directory
+ *   names and then the file names, each followed by a '\0'.  Nothing is
+ *   malloced, so listing a directory often costs no more than reading it.
+ * names - buffer for the names, at least LS_PACKED_SIZE bytes
+ * num_directories - set to the number of directory names
+ * num_files - set to the number of file names
  * returns 0 on success or one of the following error codes on failure:
  *   (this function should always succeed)
  */
-int jfs_ls(char *directories[MAX_DIR_ENTRIES + 1], char *files[MAX_DIR_ENTRIES + 1])
+static int do_ls_packed(char names[LS_PACKED_SIZE], int *num_directories, int *num_files)
 {
   // read the current dir block
   char buf[BLOCK_SIZE];
@@ -243,37 +723,85 @@ int jfs_ls(char *directories[MAX_DIR_ENTRIES + 1], char *files[MAX_DIR_ENTRIES +
     return E_UNKNOWN;
   }
 
+  // directories go out as they are found; files wait for the second pass
   uint16_t num_entries = (blk->contents).dirnode.num_entries;
-  int dir_point = 0;
-  int file_point = 0;
+  int file_entries[MAX_DIR_ENTRIES];
+  int dir_count = 0;
+  int file_count = 0;
+  char *pos = names;
   int i;
   for (i = 0; i < num_entries; i++)
   {
-    int name_len = strlen((blk->contents).dirnode.entries[i].name);
-    char *str = (char *)malloc(name_len + 1);
-    strcpy(str, (blk->contents).dirnode.entries[i].name);
     if (is_dir((blk->contents).dirnode.entries[i].block_num) == TRUE)
     {
-      directories[dir_point++] = str;
+      strcpy(pos, (blk->contents).dirnode.entries[i].name);
+      pos += strlen(pos) + 1;
+      dir_count++;
     }
     else
     {
-      files[file_point++] = str;
+      file_entries[file_count++] = i;
     }
   }
-  directories[dir_point] = NULL;
-  files[file_point] = NULL;
+  for (i = 0; i < file_count; i++)
+  {
+    strcpy(pos, (blk->contents).dirnode.entries[file_entries[i]].name);
+    pos += strlen(pos) + 1;
+  }
+  *num_directories = dir_count;
+  *num_files = file_count;
 
   return E_SUCCESS;
 }
 
-/* jfs_rmdir
- *   removes the specified subdirectory of the current directory
- * directory_name - name of the subdirectory to remove
- * returns 0 on success or one of the following error codes on failure:
- *   E_NOT_EXISTS, E_NOT_DIR, E_NOT_EMPTY
+/* jfs_ls
+ *   finds the names of all the files and directories in the current directory
+ *   and writes the directory names to the directories argument and the file
+ *   names to the files argument
+ * directories - array of strings; the function will set the strings in the
+ *   array, followed by a NULL pointer after the last valid string; the strings
+ *   should be malloced and the caller will free them
+ * file - array of strings; the function will set the strings in the
+ *   array, followed by a NULL pointer after the last valid string; the strings
+ *   should be malloced and the caller will free them
+ * returns 0 on success or one of the following error codes on failure:
+ *   (this function should always succeed)
  */
-int jfs_rmdir(const char *directory_name)
+static int do_ls(char *directories[MAX_DIR_ENTRIES + 1], char *files[MAX_DIR_ENTRIES + 1])
+{
+  char names[LS_PACKED_SIZE];
+  int num_directories, num_files;
+  int ret = do_ls_packed(names, &num_directories, &num_files);
+  if (ret != E_SUCCESS)
+  {
+    return ret;
+  }
+
+  char *pos = names;
+  int i;
+  for (i = 0; i < num_directories; i++)
+  {
+    directories[i] = strdup(pos);
+    pos += strlen(pos) + 1;
+  }
+  directories[num_directories] = NULL;
+  for (i = 0; i < num_files; i++)
+  {
+    files[i] = strdup(pos);
+    pos += strlen(pos) + 1;
+  }
+  files[num_files] = NULL;
+
+  return E_SUCCESS;
+}
+
+/* jfs_rmdir
+ *   removes the specified subdirectory of the current directory
+ * directory_name - name of the subdirectory to remove
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS, E_NOT_DIR, E_NOT_EMPTY
+ */
+static int do_rmdir(const char *directory_name)
 {
   // read the current dir block
   char buf[BLOCK_SIZE];
@@ -313,9 +841,10 @@ int jfs_rmdir(const char *directory_name)
         (blk->contents).dirnode.entries[j] = (blk->contents).dirnode.entries[j + 1];
       }
       (blk->contents).dirnode.num_entries -= 1;
-      if (write_block(current_dir, (void *)blk) < 0)
+      int ret = write_dir(blk);
+      if (ret < 0)
       {
-        return E_UNKNOWN;
+        return ret;
       }
       if (release_block(temp) < 0)
       {
@@ -334,19 +863,8 @@ int jfs_rmdir(const char *directory_name)
  * returns 0 on success or one of the following error codes on failure:
  *   E_EXISTS, E_MAX_NAME_LENGTH, E_MAX_DIR_ENTRIES, E_DISK_FULL
  */
-int jfs_creat(const char *file_name)
+static int do_creat(const char *file_name)
 {
-  // allocate a block and set dir=1
-  block_num_t next_file = allocate_block();
-  if (next_file == 0)
-  {
-    return E_DISK_FULL;
-  }
-  if (set_dir(next_file, 1) < 0)
-  {
-    return E_UNKNOWN;
-  }
-
   // read the current dir block
   char buf[BLOCK_SIZE];
   if (read_block(current_dir, buf) < 0)
@@ -380,17 +898,26 @@ int jfs_creat(const char *file_name)
     return E_MAX_NAME_LENGTH;
   }
 
+  // allocate the new file's block only after the checks above, so that a
+  // failed creat does not leak it
+  block_num_t next_file = allocate_block();
+  if (next_file == 0)
+  {
+    return E_DISK_FULL;
+  }
+  if (set_dir(next_file, 1) < 0)
+  {
+    release_block(next_file);
+    return E_UNKNOWN;
+  }
+
   // set file information
   (blk->contents).dirnode.entries[num_entries].block_num = next_file;
   strcpy((blk->contents).dirnode.entries[num_entries].name, file_name);
   // increase num_entries
   (blk->contents).dirnode.num_entries += 1;
 
-  if (write_block(current_dir, (void *)blk) < 0)
-  {
-    return E_UNKNOWN;
-  }
-  return E_SUCCESS;
+  return write_dir(blk);
 }
 
 /* jfs_remove
@@ -400,7 +927,7 @@ int jfs_creat(const char *file_name)
  * returns 0 on success or one of the following error codes on failure:
  *   E_NOT_EXISTS, E_IS_DIR
  */
-int jfs_remove(const char *file_name)
+static int do_remove(const char *file_name)
 {
   // read the current dir block
   char buf[BLOCK_SIZE];
@@ -436,9 +963,10 @@ int jfs_remove(const char *file_name)
         (blk->contents).dirnode.entries[j] = (blk->contents).dirnode.entries[j + 1];
       }
       (blk->contents).dirnode.num_entries -= 1;
-      if (write_block(current_dir, (void *)blk) < 0)
+      int ret = write_dir(blk);
+      if (ret < 0)
       {
-        return E_UNKNOWN;
+        return ret;
       }
 
       // read the file block
@@ -448,20 +976,16 @@ int jfs_remove(const char *file_name)
         return E_UNKNOWN;
       }
       struct block *blk_f = (struct block *)file_buf;
-      if ((blk_f->contents).inode.file_size != 0)
-      {
-        // the file is not empty, so we need to release relevant block
-        uint32_t f_size = (blk_f->contents).inode.file_size;
-        int file_len = (blk_f->contents).inode.file_size / BLOCK_SIZE;
-        if (f_size % BLOCK_SIZE != 0)
-          file_len += 1;
-        int fl;
-        for (fl = 0; fl < file_len; fl++)
+      // release the data blocks (none if the file is stored inline)
+      int file_len = num_data_blocks(blk_f);
+      int fl;
+      for (fl = 0; fl < file_len; fl++)
+      {
+        // a block shared by dedup only loses a reference
+        if ((blk_f->contents).inode.data_blocks[fl] != 0 &&
+            drop_block((blk_f->contents).inode.data_blocks[fl]) < 0)
         {
-          if (release_block((blk_f->contents).inode.data_blocks[fl]) < 0)
-          {
-            return E_UNKNOWN;
-          }
+          return E_UNKNOWN;
         }
       }
 
@@ -484,7 +1008,7 @@ int jfs_remove(const char *file_name)
  * returns 0 on success or one of the following error codes on failure:
  *   E_NOT_EXISTS
  */
-int jfs_stat(const char *name, struct stats *buf)
+static int do_stat(const char *name, struct stats *buf)
 {
   // read the current dir block
   char dir_buf[BLOCK_SIZE];
@@ -505,38 +1029,115 @@ int jfs_stat(const char *name, struct stats *buf)
     if (strcmp((blk->contents).dirnode.entries[i].name, name) == 0)
     {
       block_num_t temp = (blk->contents).dirnode.entries[i].block_num;
-      // set name and block_num_t
-      buf->block_num = temp;
-      strcpy(buf->name, name);
-
       // read the file block
       char temp_buf[BLOCK_SIZE];
       if (read_block(temp, temp_buf) < 0)
       {
         return E_UNKNOWN;
       }
-      struct block *blk_temp = (struct block *)temp_buf;
-      if (blk_temp->is_dir == dir)
-      {
-        buf->is_dir = dir;
-        return E_SUCCESS;
-      }
-      else
-      {
-        buf->is_dir = file;
-        buf->file_size = (blk_temp->contents).inode.file_size;
-        int blk_len = (blk_temp->contents).inode.file_size / BLOCK_SIZE;
-        if ((blk_temp->contents).inode.file_size % BLOCK_SIZE != 0)
-          blk_len += 1;
-        buf->num_data_blocks = blk_len;
-        return E_SUCCESS;
-      }
+      fill_stats(buf, name, temp, (struct block *)temp_buf);
+      return E_SUCCESS;
     }
   }
 
   return E_NOT_EXISTS;
 }
 
+/* store_compressed
+ *   replaces the contents of a compressed file: the data is compressed and
+ *   stored as one extent, inline if it fits and otherwise in consecutive data
+ *   blocks (reusing the file's blocks where possible).  Data that does not
+ *   get smaller is stored as is.
+ */
+static int store_compressed(void *dir_buf, int i, struct block *blk_temp, const char *data, int size)
+{
+  int ret;
+  char packed[MAX_FILE_SIZE];
+  int packed_len = lz_compress(data, size, packed, size - 1);
+  const char *stream = packed_len > 0 ? packed : data;
+  int len = packed_len > 0 ? packed_len : size;
+
+  int old_n = num_data_blocks(blk_temp);
+  block_num_t old_blocks[MAX_DATA_BLOCKS];
+  memcpy(old_blocks, (blk_temp->contents).inode.data_blocks, old_n * sizeof(block_num_t));
+  int new_n = len <= (int)MAX_INLINE_SIZE ? 0 : (len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  int more = new_n > old_n ? new_n - old_n : 0;
+
+  // reused blocks may have to be copied if a snapshot shares them
+  int need = more + cow_reserve();
+  if (bfs_num_snapshots() > 0)
+  {
+    need += new_n - more;
+  }
+  if (need > bfs_free_blocks())
+  {
+    return E_DISK_FULL;
+  }
+  block_num_t new_blocks[MAX_DATA_BLOCKS];
+  if (more > 0 && allocate_blocks(more, new_blocks) < 0)
+  {
+    return E_DISK_FULL;
+  }
+
+  (blk_temp->contents).inode.file_size = size;
+  (blk_temp->contents).inode.stored_size = packed_len > 0 ? packed_len : 0;
+  if (new_n == 0)
+  {
+    memcpy((blk_temp->contents).inode.data, stream, len);
+  }
+  int bk;
+  for (bk = 0; bk < new_n; bk++)
+  {
+    char write_buf[BLOCK_SIZE];
+    memset(write_buf, -1, BLOCK_SIZE);
+    int write_len = len - bk * BLOCK_SIZE < BLOCK_SIZE ? len - bk * BLOCK_SIZE : BLOCK_SIZE;
+    memcpy(write_buf, stream + bk * BLOCK_SIZE, write_len);
+    block_num_t *data_block = &(blk_temp->contents).inode.data_blocks[bk];
+    if (bk < old_n)
+    {
+      *data_block = old_blocks[bk];
+      ret = write_cow(data_block, write_buf);
+    }
+    else
+    {
+      *data_block = new_blocks[bk - old_n];
+      ret = write_block(*data_block, write_buf) < 0 ? E_UNKNOWN : E_SUCCESS;
+    }
+    if (ret < 0)
+    {
+      return ret;
+    }
+  }
+
+  ret = write_inode(dir_buf, i, blk_temp);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  // release the blocks the file no longer needs
+  for (bk = new_n; bk < old_n; bk++)
+  {
+    if (drop_block(old_blocks[bk]) < 0)
+    {
+      return E_UNKNOWN;
+    }
+  }
+  return E_SUCCESS;
+}
+
+// appends to a compressed file (see store_compressed())
+static int write_compressed(void *dir_buf, int i, struct block *blk_temp, const void *buf, unsigned short count)
+{
+  char data[MAX_FILE_SIZE];
+  int ret = unpack_data(blk_temp, data);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  memcpy(data + (blk_temp->contents).inode.file_size, buf, count);
+  return store_compressed(dir_buf, i, blk_temp, data, (blk_temp->contents).inode.file_size + count);
+}
+
 /* jfs_write
  *   appends the data in the buffer to the end of the specified file
  * file_name - name of the file to append data to
@@ -547,7 +1148,7 @@ int jfs_stat(const char *name, struct stats *buf)
  * returns 0 on success or one of the following error codes on failure:
  *   E_NOT_EXISTS, E_IS_DIR, E_MAX_FILE_SIZE, E_DISK_FULL
  */
-int jfs_write(const char *file_name, const void *buf, unsigned short count)
+static int do_write(const char *file_name, const void *buf, unsigned short count)
 {
   // read the current dir block
   char dir_buf[BLOCK_SIZE];
@@ -585,13 +1186,41 @@ int jfs_write(const char *file_name, const void *buf, unsigned short count)
       uint32_t fz = (blk_temp->contents).inode.file_size;
       if (fz + count > MAX_FILE_SIZE)
         return E_MAX_FILE_SIZE;
+
+      if (blk_temp->flags & INODE_COMPRESSED)
+      {
+        return write_compressed(dir_buf, i, blk_temp, buf, count);
+      }
+
+      if (fz + count <= MAX_INLINE_SIZE)
+      {
+        // the file still fits inline, so only the inode is written
+        memcpy((blk_temp->contents).inode.data + fz, buf, count);
+        (blk_temp->contents).inode.file_size += count;
+        return write_inode(dir_buf, i, blk_temp);
+      }
+
+      // append_len is the number of bytes to store in data blocks
+      int append_len = count;
+      const char *res_buf = (const char *)buf;
+      char promote_buf[MAX_FILE_SIZE];
+      if (fz > 0 && fz <= MAX_INLINE_SIZE)
+      {
+        // the file outgrows its inline data: move the inline data to the
+        // first data block, followed by the new data
+        memcpy(promote_buf, (blk_temp->contents).inode.data, fz);
+        memcpy(promote_buf + fz, buf, count);
+        res_buf = promote_buf;
+        append_len = fz + count;
+        fz = 0;
+      }
       // calculate the block that we need to allocate
       int more_blk;
       bool_t need_blk = TRUE;
       if (fz % BLOCK_SIZE != 0)
       {
         int last_blk_ava = BLOCK_SIZE - (fz % BLOCK_SIZE);
-        if (count <= last_blk_ava)
+        if (append_len <= last_blk_ava)
         {
           // no need to apply new block
           more_blk = 1;
@@ -600,43 +1229,68 @@ int jfs_write(const char *file_name, const void *buf, unsigned short count)
         else
         {
           // need to apply new block and calculate
-          more_blk = (count - (BLOCK_SIZE - (fz % BLOCK_SIZE))) / BLOCK_SIZE;
-          if ((count - (BLOCK_SIZE - (fz % BLOCK_SIZE))) % BLOCK_SIZE != 0)
+          more_blk = (append_len - (BLOCK_SIZE - (fz % BLOCK_SIZE))) / BLOCK_SIZE;
+          if ((append_len - (BLOCK_SIZE - (fz % BLOCK_SIZE))) % BLOCK_SIZE != 0)
             more_blk += 1;
         }
       }
       else
       {
-        more_blk = count / BLOCK_SIZE;
-        if (count % BLOCK_SIZE != 0)
+        more_blk = append_len / BLOCK_SIZE;
+        if (append_len % BLOCK_SIZE != 0)
           more_blk += 1;
       }
-      block_num_t new_blk_arr[more_blk];
+      // with dedup on, a new full block identical to one already stored
+      // shares that block instead of getting its own (more_blk is at most
+      // MAX_DATA_BLOCKS, so these are sized for the largest write)
+      block_num_t new_blk_arr[MAX_DATA_BLOCKS];
+      bool_t shared[MAX_DATA_BLOCKS];
+      int num_alloc = 0;
       if (need_blk == TRUE)
       {
+        int first_off = fz % BLOCK_SIZE != 0 ? BLOCK_SIZE - (fz % BLOCK_SIZE) : 0;
         int j;
         for (j = 0; j < more_blk; j++)
         {
-          block_num_t next_blk = allocate_block();
-          if (next_blk == 0)
+          new_blk_arr[j] = 0;
+          if (first_off + (j + 1) * BLOCK_SIZE <= append_len)
           {
-            int k;
-            for (k = j - 1; k >= 0; k--)
-            {
-              release_block(new_blk_arr[k]);
-            }
-            return E_DISK_FULL;
+            new_blk_arr[j] = dedup_find(res_buf + first_off + j * BLOCK_SIZE);
           }
-          else
+          shared[j] = new_blk_arr[j] != 0;
+          if (shared[j] == FALSE)
+          {
+            num_alloc++;
+          }
+        }
+      }
+      // a partial last block may be a hole that needs a block too
+      int hole_alloc = fz % BLOCK_SIZE != 0 && (blk_temp->contents).inode.data_blocks[fz / BLOCK_SIZE] == 0;
+      // reject writes that cannot fit before allocating anything
+      if (num_alloc + hole_alloc + cow_reserve() > bfs_free_blocks())
+      {
+        return E_DISK_FULL;
+      }
+      if (num_alloc > 0)
+      {
+        // allocate all the new blocks with a single bitmap update
+        block_num_t alloc_arr[MAX_DATA_BLOCKS];
+        if (allocate_blocks(num_alloc, alloc_arr) < 0)
+        {
+          return E_DISK_FULL;
+        }
+        int j, k = 0;
+        for (j = 0; j < more_blk; j++)
+        {
+          if (shared[j] == FALSE)
           {
-            new_blk_arr[j] = next_blk;
+            new_blk_arr[j] = alloc_arr[k++];
           }
         }
       }
 
       // written_byte is the length of bytes that required to append
-      int written_byte = count;
-      char *res_buf = (char *)buf;
+      int written_byte = append_len;
 
       // start to write data to file block
       // first, check whether there is block that not full
@@ -644,20 +1298,36 @@ int jfs_write(const char *file_name, const void *buf, unsigned short count)
       if (fz % BLOCK_SIZE != 0)
       {
         // append to last block, which is not full
-        block_num_t last = (blk_temp->contents).inode.data_blocks[blk_len];
+        block_num_t *last = &(blk_temp->contents).inode.data_blocks[blk_len];
         int used = fz % BLOCK_SIZE;
         int left = BLOCK_SIZE - used;
         char prev_buf[BLOCK_SIZE];
-        if (read_block(last, prev_buf) < 0)
+        if (*last == 0)
+        {
+          // a hole: start from zeros in a new block
+          memset(prev_buf, 0, BLOCK_SIZE);
+          *last = allocate_block();
+          if (*last == 0)
+          {
+            return E_DISK_FULL;
+          }
+        }
+        else if (read_block(*last, prev_buf) < 0)
         {
           return E_UNKNOWN;
         }
         int temp_write_len = written_byte - left >= 0 ? left : written_byte;
         memcpy(prev_buf + used, res_buf, temp_write_len);
         written_byte -= temp_write_len;
-        if (write_block(last, (void *)prev_buf) < 0)
+        // may move the block if a snapshot shares it; the inode is written below
+        int ret = write_cow(last, prev_buf);
+        if (ret < 0)
         {
-          return E_UNKNOWN;
+          return ret;
+        }
+        if (used + temp_write_len == BLOCK_SIZE)
+        {
+          dedup_insert(prev_buf, *last);
         }
         blk_len++;
       }
@@ -666,24 +1336,39 @@ int jfs_write(const char *file_name, const void *buf, unsigned short count)
       {
         // allocate a new block to store the data
         int blk_point;
-        int buf_point = count - written_byte;
+        int buf_point = append_len - written_byte;
         for (blk_point = 0; blk_point < more_blk; blk_point++)
         {
           block_num_t wrt_blk = new_blk_arr[blk_point];
           (blk_temp->contents).inode.data_blocks[blk_len] = wrt_blk;
-          char write_buf[BLOCK_SIZE];
-          memset(write_buf, -1, BLOCK_SIZE);
           int write_len = written_byte >= BLOCK_SIZE ? BLOCK_SIZE : written_byte;
-          // int p;
-          // for (p = 0; p < write_len; p++)
-          // {
-          //   write_buf[p] = res_buf[p + buf_point];
-          //   // printf("the write char is : %c\n", (char)res_buf[p + buf_point]);
-          // }
-          memcpy(write_buf, res_buf + buf_point, write_len);
-          if (write_block(wrt_blk, (void *)write_buf) < 0)
+          if (shared[blk_point] == TRUE)
+          {
+            // the block already holds this data
+            if (bfs_share_block(wrt_blk) < 0)
+            {
+              return E_UNKNOWN;
+            }
+          }
+          else
           {
-            return E_UNKNOWN;
+            char write_buf[BLOCK_SIZE];
+            memset(write_buf, -1, BLOCK_SIZE);
+            // int p;
+            // for (p = 0; p < write_len; p++)
+            // {
+            //   write_buf[p] = res_buf[p + buf_point];
+            //   // printf("the write char is : %c\n", (char)res_buf[p + buf_point]);
+            // }
+            memcpy(write_buf, res_buf + buf_point, write_len);
+            if (write_block(wrt_blk, (void *)write_buf) < 0)
+            {
+              return E_UNKNOWN;
+            }
+            if (write_len == BLOCK_SIZE)
+            {
+              dedup_insert(write_buf, wrt_blk);
+            }
           }
           written_byte -= write_len;
           buf_point += write_len;
@@ -693,18 +1378,158 @@ int jfs_write(const char *file_name, const void *buf, unsigned short count)
 
       // write back the file inode information
       (blk_temp->contents).inode.file_size += count;
-      if (write_block(temp, (void *)blk_temp) < 0)
-      {
-        return E_UNKNOWN;
-      }
-
-      return E_SUCCESS;
+      return write_inode(dir_buf, i, blk_temp);
     }
   }
 
   return E_NOT_EXISTS;
 }
 
+// parallel reads (see jfs_set_read_threads()): the data blocks of a file are
+// split into runs of consecutive blocks, which the reading thread and the
+// pool's workers take one at a time and read straight into their own part of
+// the caller's buffer
+struct read_run
+{
+  block_num_t first_block;
+  block_num_t num_blocks;
+  char *dest;
+};
+
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t work; // runs were handed out, or the workers should stop
+  pthread_cond_t done; // the last run was read
+  pthread_t workers[MAX_READ_THREADS - 1];
+  int num_workers;
+  bool_t stop;
+  struct read_run runs[MAX_DATA_BLOCKS];
+  int num_runs;
+  int next_run;  // next run to take
+  int runs_left; // runs not read yet
+  bool_t failed; // some run could not be read
+} read_pool = {.lock = PTHREAD_MUTEX_INITIALIZER,
+               .work = PTHREAD_COND_INITIALIZER,
+               .done = PTHREAD_COND_INITIALIZER};
+
+// reads a run and checks its blocks against their checksums
+static bool_t read_run(const struct read_run *run)
+{
+  if (read_blocks(run->first_block, run->num_blocks, run->dest) < 0)
+  {
+    return FALSE;
+  }
+  int i;
+  for (i = 0; i < run->num_blocks; i++)
+  {
+    if (!raw_verify_block(run->first_block + i, run->dest + i * BLOCK_SIZE))
+    {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+// reads runs until none are left to take (called with read_pool.lock held)
+static void take_runs()
+{
+  while (read_pool.next_run < read_pool.num_runs)
+  {
+    struct read_run *run = &read_pool.runs[read_pool.next_run++];
+    pthread_mutex_unlock(&read_pool.lock);
+    bool_t ok = read_run(run);
+    pthread_mutex_lock(&read_pool.lock);
+    if (ok == FALSE)
+    {
+      read_pool.failed = TRUE;
+    }
+    if (--read_pool.runs_left == 0)
+    {
+      pthread_cond_signal(&read_pool.done);
+    }
+  }
+}
+
+static void *read_worker(void *arg)
+{
+  (void)arg;
+  pthread_mutex_lock(&read_pool.lock);
+  while (read_pool.stop == FALSE)
+  {
+    take_runs();
+    if (read_pool.stop == FALSE)
+    {
+      pthread_cond_wait(&read_pool.work, &read_pool.lock);
+    }
+  }
+  pthread_mutex_unlock(&read_pool.lock);
+  return NULL;
+}
+
+static void stop_read_workers()
+{
+  pthread_mutex_lock(&read_pool.lock);
+  read_pool.stop = TRUE;
+  pthread_cond_broadcast(&read_pool.work);
+  pthread_mutex_unlock(&read_pool.lock);
+  int i;
+  for (i = 0; i < read_pool.num_workers; i++)
+  {
+    pthread_join(read_pool.workers[i], NULL);
+  }
+  read_pool.num_workers = 0;
+  read_pool.stop = FALSE;
+}
+
+/* read_parallel
+ *   reads the first num_blocks data blocks of a file into dest with the
+ *   worker pool, in runs short enough to give every thread a share
+ * returns 0 on success or -1 on failure
+ */
+static int read_parallel(const block_num_t *data_blocks, int num_blocks, char *dest)
+{
+  int max_run = (num_blocks + read_pool.num_workers) / (read_pool.num_workers + 1);
+  pthread_mutex_lock(&read_pool.lock);
+  int num_runs = 0;
+  int bk = 0;
+  while (bk < num_blocks)
+  {
+    if (data_blocks[bk] == 0)
+    {
+      // a hole reads as zeros
+      memset(dest + bk * BLOCK_SIZE, 0, BLOCK_SIZE);
+      bk++;
+      continue;
+    }
+    struct read_run *run = &read_pool.runs[num_runs++];
+    run->first_block = data_blocks[bk];
+    run->num_blocks = 1;
+    run->dest = dest + bk * BLOCK_SIZE;
+    for (bk++; bk < num_blocks && run->num_blocks < max_run &&
+               data_blocks[bk] == run->first_block + run->num_blocks;
+         bk++)
+    {
+      run->num_blocks++;
+    }
+  }
+  read_pool.num_runs = num_runs;
+  read_pool.next_run = 0;
+  read_pool.runs_left = num_runs;
+  read_pool.failed = FALSE;
+  pthread_cond_broadcast(&read_pool.work);
+
+  // the reading thread takes runs too
+  take_runs();
+  while (read_pool.runs_left > 0)
+  {
+    pthread_cond_wait(&read_pool.done, &read_pool.lock);
+  }
+  int ret = read_pool.failed == TRUE ? -1 : 0;
+  pthread_mutex_unlock(&read_pool.lock);
+  return ret;
+}
+
 /* jfs_read
  *   reads the specified file and copies its contents into the buffer, up to a
  *   maximum of *ptr_count bytes copied (but obviously no more than the file
@@ -718,7 +1543,7 @@ int jfs_write(const char *file_name, const void *buf, unsigned short count)
  * returns 0 on success or one of the following error codes on failure:
  *   E_NOT_EXISTS, E_IS_DIR
  */
-int jfs_read(const char *file_name, void *buf, unsigned short *ptr_count)
+static int do_read(const char *file_name, void *buf, unsigned short *ptr_count)
 {
   // read the current dir block
   char dir_buf[BLOCK_SIZE];
@@ -754,6 +1579,25 @@ int jfs_read(const char *file_name, void *buf, unsigned short *ptr_count)
 
       uint32_t fz = (blk_temp->contents).inode.file_size;
       char *res_buf = (char *)buf;
+      if (blk_temp->flags & INODE_COMPRESSED)
+      {
+        char data[MAX_FILE_SIZE];
+        int ret = unpack_data(blk_temp, data);
+        if (ret < 0)
+        {
+          return ret;
+        }
+        *ptr_count = *ptr_count > fz ? fz : *ptr_count;
+        memcpy(res_buf, data, *ptr_count);
+        return E_SUCCESS;
+      }
+      if (fz <= MAX_INLINE_SIZE)
+      {
+        // small files are stored in the inode itself
+        *ptr_count = *ptr_count > fz ? fz : *ptr_count;
+        memcpy(res_buf, (blk_temp->contents).inode.data, *ptr_count);
+        return E_SUCCESS;
+      }
       // start to read data from file block
       // first, calculate the number of blocks the file has
       int blk_len = fz / BLOCK_SIZE;
@@ -762,13 +1606,29 @@ int jfs_read(const char *file_name, void *buf, unsigned short *ptr_count)
 
       unsigned short read_num = *ptr_count > fz ? fz : *ptr_count;
       int buf_point = 0;
-      int bk;
-      for (bk = 0; bk < blk_len; bk++)
+      int bk = 0;
+      if (read_pool.num_workers > 0 && read_num / BLOCK_SIZE > 1)
+      {
+        // the pool reads the full blocks; a partial last one is read below
+        bk = read_num / BLOCK_SIZE;
+        if (read_parallel((blk_temp->contents).inode.data_blocks, bk, res_buf) < 0)
+        {
+          return E_UNKNOWN;
+        }
+        buf_point = bk * BLOCK_SIZE;
+        read_num -= buf_point;
+      }
+      for (; bk < blk_len && read_num > 0; bk++)
       {
         block_num_t read_blk = (blk_temp->contents).inode.data_blocks[bk];
         // printf("block_num_t is %d\n", read_blk);
         char read_buf[BLOCK_SIZE];
-        if (read_block(read_blk, read_buf) < 0)
+        if (read_blk == 0)
+        {
+          // a hole reads as zeros
+          memset(read_buf, 0, BLOCK_SIZE);
+        }
+        else if (read_block(read_blk, read_buf) < 0)
         {
           return E_UNKNOWN;
         }
@@ -795,18 +1655,1298 @@ int jfs_read(const char *file_name, void *buf, unsigned short *ptr_count)
   return E_NOT_EXISTS;
 }
 
-/* jfs_unmount
- *   makes the file system no longer accessible (unless it is mounted again).
- *   This should be called exactly once after all other jfs_* operations are
- *   complete; it is invalid to call any other jfs_* function (except
- *   jfs_mount) after this function complete.  Basically, this closes the DISK
- *   file on the _real_ file system.  If your code requires any clean up after
- *   all other jfs_* functions are done, you may add it here.
- * returns 0 on success or -1 on error; errors should only occur due to
- *   errors in the underlying disk syscalls.
- */
-int jfs_unmount()
+// reads the current directory block into dir_buf and the inode of one of
+// its files into inode_buf
+// returns the index of the file's entry, or E_NOT_EXISTS or E_IS_DIR
+static int find_file(const char *file_name, char *dir_buf, char *inode_buf)
 {
+  if (read_block(current_dir, dir_buf) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  struct block *blk = (struct block *)dir_buf;
+  int i = find_entry(blk, file_name);
+  if (i < 0)
+  {
+    return E_NOT_EXISTS;
+  }
+  if (read_block((blk->contents).dirnode.entries[i].block_num, inode_buf) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  if (((struct block *)inode_buf)->is_dir == dir)
+  {
+    return E_IS_DIR;
+  }
+  return i;
+}
+
+// releases data blocks no longer used by a file, with a single bitmap update
+static int release_data(const block_num_t *blocks, int count)
+{
+  block_num_t list[MAX_DATA_BLOCKS];
+  int n = 0;
+  int k;
+  for (k = 0; k < count; k++)
+  {
+    if (blocks[k] == 0)
+    {
+      continue; // a hole
+    }
+    if (bfs_refcount(blocks[k]) == 0)
+    {
+      dedup_forget(blocks[k]);
+    }
+    list[n++] = blocks[k];
+  }
+  if (n > 0 && release_blocks(n, list) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  return E_SUCCESS;
+}
+
+// sets bytes [from, to) of data block k of a file to zero; the inode must be
+// written afterwards, since the block may be copied
+static int zero_range(struct block *blk, int k, int from, int to)
+{
+  block_num_t *block_num = &(blk->contents).inode.data_blocks[k];
+  if (*block_num == 0)
+  {
+    return E_SUCCESS; // a hole is zeros already
+  }
+  char buf[BLOCK_SIZE];
+  if (read_block(*block_num, buf) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  memset(buf + from, 0, to - from);
+  return write_cow(block_num, buf);
+}
+
+/* jfs_truncate
+ *   changes the size of a file without rewriting its data: shrinking
+ *   releases the data blocks past the new end, and growing adds zeros,
+ *   stored as holes (see jfs_punch_hole()) where they fill whole blocks
+ * file_name - name of the file
+ * size - new size of the file, in bytes
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS, E_IS_DIR, E_MAX_FILE_SIZE, E_DISK_FULL
+ */
+static int do_truncate(const char *file_name, unsigned short size)
+{
+  char dir_buf[BLOCK_SIZE];
+  char inode_buf[BLOCK_SIZE];
+  int i = find_file(file_name, dir_buf, inode_buf);
+  if (i < 0)
+  {
+    return i;
+  }
+  struct block *blk = (struct block *)inode_buf;
+  if (size > MAX_FILE_SIZE)
+  {
+    return E_MAX_FILE_SIZE;
+  }
+  int fz = (blk->contents).inode.file_size;
+  if (size == fz)
+  {
+    return E_SUCCESS;
+  }
+
+  if (blk->flags & INODE_COMPRESSED)
+  {
+    char data[MAX_FILE_SIZE];
+    int ret = unpack_data(blk, data);
+    if (ret < 0)
+    {
+      return ret;
+    }
+    if (size > fz)
+    {
+      memset(data + fz, 0, size - fz);
+    }
+    return store_compressed(dir_buf, i, blk, data, size);
+  }
+
+  int old_n = num_data_blocks(blk);
+  block_num_t old_blocks[MAX_DATA_BLOCKS];
+  memcpy(old_blocks, (blk->contents).inode.data_blocks, old_n * sizeof(block_num_t));
+  int new_n = size <= MAX_INLINE_SIZE ? 0 : (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  int ret;
+
+  if (size < fz)
+  {
+    if (new_n == 0 && old_n > 0)
+    {
+      // the rest of the file fits inline again
+      char data[MAX_INLINE_SIZE];
+      int bk;
+      for (bk = 0; bk * BLOCK_SIZE < size; bk++)
+      {
+        char read_buf[BLOCK_SIZE];
+        memset(read_buf, 0, BLOCK_SIZE);
+        if (old_blocks[bk] != 0 && read_block(old_blocks[bk], read_buf) < 0)
+        {
+          return E_UNKNOWN;
+        }
+        int len = size - bk * BLOCK_SIZE < BLOCK_SIZE ? size - bk * BLOCK_SIZE : BLOCK_SIZE;
+        memcpy(data + bk * BLOCK_SIZE, read_buf, len);
+      }
+      memcpy((blk->contents).inode.data, data, size);
+    }
+    (blk->contents).inode.file_size = size;
+    ret = write_inode(dir_buf, i, blk);
+    if (ret < 0)
+    {
+      return ret;
+    }
+    return release_data(old_blocks + new_n, old_n - new_n);
+  }
+
+  // growing: the new bytes are zeros
+  if (1 + cow_reserve() > bfs_free_blocks())
+  {
+    return E_DISK_FULL;
+  }
+  if (new_n == 0)
+  {
+    memset((blk->contents).inode.data + fz, 0, size - fz);
+  }
+  else if (old_n == 0)
+  {
+    // the inline data moves to the first data block; the rest are holes
+    char first[BLOCK_SIZE];
+    memset(first, 0, BLOCK_SIZE);
+    memcpy(first, (blk->contents).inode.data, fz);
+    memset((blk->contents).inode.data_blocks, 0, sizeof((blk->contents).inode.data_blocks));
+    if (fz > 0)
+    {
+      block_num_t first_block = allocate_block();
+      if (first_block == 0)
+      {
+        return E_DISK_FULL;
+      }
+      if (write_block(first_block, first) < 0)
+      {
+        return E_UNKNOWN;
+      }
+      (blk->contents).inode.data_blocks[0] = first_block;
+    }
+  }
+  else
+  {
+    // old bytes past the end of the last block must read as zeros
+    if (fz % BLOCK_SIZE != 0)
+    {
+      ret = zero_range(blk, old_n - 1, fz % BLOCK_SIZE, BLOCK_SIZE);
+      if (ret < 0)
+      {
+        return ret;
+      }
+    }
+    memset((blk->contents).inode.data_blocks + old_n, 0, (new_n - old_n) * sizeof(block_num_t));
+  }
+  (blk->contents).inode.file_size = size;
+  return write_inode(dir_buf, i, blk);
+}
+
+/* jfs_punch_hole
+ *   sets a range of a file to zeros; data blocks inside the range are
+ *   released (they become holes, which read as zeros) and only the blocks at
+ *   either end of the range are rewritten.  The file size does not change.
+ * file_name - name of the file
+ * offset - first byte of the range
+ * length - number of bytes in the range (the part past the end of the file
+ *   is ignored)
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS, E_IS_DIR, E_DISK_FULL
+ */
+static int do_punch_hole(const char *file_name, unsigned short offset, unsigned short length)
+{
+  char dir_buf[BLOCK_SIZE];
+  char inode_buf[BLOCK_SIZE];
+  int i = find_file(file_name, dir_buf, inode_buf);
+  if (i < 0)
+  {
+    return i;
+  }
+  struct block *blk = (struct block *)inode_buf;
+  int fz = (blk->contents).inode.file_size;
+  int end = offset + length < fz ? offset + length : fz;
+  if (offset >= end)
+  {
+    return E_SUCCESS;
+  }
+
+  if (blk->flags & INODE_COMPRESSED)
+  {
+    char data[MAX_FILE_SIZE];
+    int ret = unpack_data(blk, data);
+    if (ret < 0)
+    {
+      return ret;
+    }
+    memset(data + offset, 0, end - offset);
+    return store_compressed(dir_buf, i, blk, data, fz);
+  }
+  if (fz <= (int)MAX_INLINE_SIZE)
+  {
+    memset((blk->contents).inode.data + offset, 0, end - offset);
+    return write_inode(dir_buf, i, blk);
+  }
+
+  // blocks partly in the range are zeroed; the ones after first_full, up to
+  // last_full, are released (including a partial last block when the range
+  // runs to the end of the file)
+  int head = offset / BLOCK_SIZE;
+  int tail = end / BLOCK_SIZE;
+  int first_full = (offset + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  int last_full = end == fz ? num_data_blocks(blk) : tail;
+  bool_t zero_head = offset % BLOCK_SIZE != 0;
+  bool_t zero_tail = end < fz && end % BLOCK_SIZE != 0 && (tail != head || zero_head == FALSE);
+
+  int need = cow_reserve();
+  if (zero_head == TRUE && (blk->contents).inode.data_blocks[head] != 0 &&
+      must_copy((blk->contents).inode.data_blocks[head]))
+  {
+    need++;
+  }
+  if (zero_tail == TRUE && (blk->contents).inode.data_blocks[tail] != 0 &&
+      must_copy((blk->contents).inode.data_blocks[tail]))
+  {
+    need++;
+  }
+  if (need > bfs_free_blocks())
+  {
+    return E_DISK_FULL;
+  }
+
+  int ret = E_SUCCESS;
+  if (zero_head == TRUE)
+  {
+    int to = head == tail ? end % BLOCK_SIZE : BLOCK_SIZE;
+    ret = zero_range(blk, head, offset % BLOCK_SIZE, to);
+  }
+  if (ret == E_SUCCESS && zero_tail == TRUE)
+  {
+    ret = zero_range(blk, tail, 0, end % BLOCK_SIZE);
+  }
+  if (ret < 0)
+  {
+    return ret;
+  }
+
+  block_num_t freed[MAX_DATA_BLOCKS];
+  int num_freed = 0;
+  int bk;
+  for (bk = first_full; bk < last_full; bk++)
+  {
+    freed[num_freed++] = (blk->contents).inode.data_blocks[bk];
+    (blk->contents).inode.data_blocks[bk] = 0;
+  }
+  ret = write_inode(dir_buf, i, blk);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  return release_data(freed, num_freed);
+}
+
+// visit_fn for jfs_remove_tree(): collects every block of the tree
+struct tree_blocks
+{
+  block_num_t *blocks;
+  int count;
+};
+
+static int collect_blocks(block_num_t block_num, struct block *blk, const char *path, void *arg)
+{
+  (void)path;
+  struct tree_blocks *tree = (struct tree_blocks *)arg;
+  tree->blocks[tree->count++] = block_num;
+  if (blk->is_dir != dir)
+  {
+    int num_data = num_data_blocks(blk);
+    int bk;
+    for (bk = 0; bk < num_data; bk++)
+    {
+      if ((blk->contents).inode.data_blocks[bk] != 0)
+      {
+        tree->blocks[tree->count++] = (blk->contents).inode.data_blocks[bk];
+      }
+    }
+  }
+  return 0;
+}
+
+/* jfs_remove_tree
+ *   removes a file, or a directory and everything in it, from the current
+ *   directory.  The tree is read once and all of its blocks are released
+ *   with a single bitmap update.
+ * name - name of the file or directory to remove
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS
+ */
+static int do_remove_tree(const char *name)
+{
+  char dir_buf[BLOCK_SIZE];
+  if (read_block(current_dir, dir_buf) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  struct block *blk = (struct block *)dir_buf;
+  int i = find_entry(blk, name);
+  if (i < 0)
+  {
+    return E_NOT_EXISTS;
+  }
+
+  struct tree_blocks tree;
+  tree.blocks = removed_blocks;
+  tree.count = 0;
+  char path[MAX_PATH_LENGTH + 1] = "";
+  int ret = traverse((blk->contents).dirnode.entries[i].block_num, path, 0, collect_blocks, &tree);
+
+  if (ret == E_SUCCESS)
+  {
+    int num_entries = (blk->contents).dirnode.num_entries;
+    memmove(&(blk->contents).dirnode.entries[i], &(blk->contents).dirnode.entries[i + 1],
+            (num_entries - i - 1) * sizeof((blk->contents).dirnode.entries[0]));
+    (blk->contents).dirnode.num_entries -= 1;
+    ret = write_dir(blk);
+  }
+  if (ret == E_SUCCESS)
+  {
+    int j;
+    for (j = 0; j < tree.count; j++)
+    {
+      dedup_forget(tree.blocks[j]);
+    }
+    if (release_blocks(tree.count, tree.blocks) < 0)
+    {
+      ret = E_UNKNOWN;
+    }
+  }
+  return ret;
+}
+
+// visit_fn for jfs_du()
+static int add_usage(block_num_t block_num, struct block *blk, const char *path, void *arg)
+{
+  (void)block_num;
+  (void)path;
+  struct du_stats *buf = (struct du_stats *)arg;
+  buf->num_blocks++;
+  if (blk->is_dir == dir)
+  {
+    buf->num_dirs++;
+  }
+  else
+  {
+    buf->num_files++;
+    buf->file_bytes += (blk->contents).inode.file_size;
+    buf->num_blocks += num_allocated_blocks(blk);
+  }
+  return 0;
+}
+
+/* jfs_du
+ *   adds up the space used by a file, or by a directory and everything in it
+ * name - name of a file or directory in the current directory, or NULL for
+ *   the current directory itself
+ * buf - pointer to a struct du_stats (already allocated by the caller) where
+ *   the totals will be written; a data block shared by dedup is counted for
+ *   every file using it
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS
+ */
+static int do_du(const char *name, struct du_stats *buf)
+{
+  block_num_t start = current_dir;
+  if (name != NULL)
+  {
+    char dir_buf[BLOCK_SIZE];
+    if (read_block(current_dir, dir_buf) < 0)
+    {
+      return E_UNKNOWN;
+    }
+    struct block *blk = (struct block *)dir_buf;
+    int i = find_entry(blk, name);
+    if (i < 0)
+    {
+      return E_NOT_EXISTS;
+    }
+    start = (blk->contents).dirnode.entries[i].block_num;
+  }
+
+  memset(buf, 0, sizeof(*buf));
+  char path[MAX_PATH_LENGTH + 1] = "";
+  return traverse(start, path, 0, add_usage, buf);
+}
+
+// visit_fn for jfs_walk(): passes everything but the starting directory on
+// to the caller's visitor
+struct walk_args
+{
+  jfs_visitor_t visitor;
+  void *arg;
+};
+
+static int visit_entry(block_num_t block_num, struct block *blk, const char *path, void *arg)
+{
+  struct walk_args *args = (struct walk_args *)arg;
+  if (path[0] == '\0')
+  {
+    return 0;
+  }
+  const char *name = strrchr(path, '/');
+  name = name == NULL ? path : name + 1;
+  struct stats st;
+  fill_stats(&st, name, block_num, blk);
+  return args->visitor(path, &st, args->arg);
+}
+
+/* jfs_walk
+ *   calls a visitor for every file and directory below the current
+ *   directory, depth first (a directory comes before its contents); every
+ *   block is read once
+ * visitor - function to call (see jfs_visitor_t)
+ * arg - passed to the visitor unchanged
+ * returns 0 on success, or the value other than 0 returned by the visitor
+ */
+static int do_walk(jfs_visitor_t visitor, void *arg)
+{
+  struct walk_args args = {visitor, arg};
+  char path[MAX_PATH_LENGTH + 1] = "";
+  return traverse(current_dir, path, 0, visit_entry, &args);
+}
+
+/* resolve_parent
+ *   follows a path ("name", "dir/name" or "/dir/name"; relative paths start
+ *   at the current directory) to the directory holding its last component
+ * path - set to the directory blocks from the root down to that directory
+ * depth - set to the index of that directory in path
+ * name - set to the last component (MAX_NAME_LENGTH + 1 bytes)
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS, E_NOT_DIR, E_MAX_NAME_LENGTH
+ */
+static int resolve_parent(const char *pathname, block_num_t *path, int *depth, char *name)
+{
+  if (pathname[0] == '/')
+  {
+    path[0] = bfs_root();
+    *depth = 0;
+  }
+  else
+  {
+    memcpy(path, dir_path, (dir_depth + 1) * sizeof(block_num_t));
+    *depth = dir_depth;
+  }
+
+  char copy[MAX_PATH_LENGTH + 1];
+  if (strlen(pathname) > MAX_PATH_LENGTH)
+  {
+    return E_NOT_EXISTS;
+  }
+  strcpy(copy, pathname);
+  char *saveptr = NULL;
+  char *component = strtok_r(copy, "/", &saveptr);
+  if (component == NULL)
+  {
+    return E_NOT_EXISTS; // no last component
+  }
+  char *next;
+  while ((next = strtok_r(NULL, "/", &saveptr)) != NULL)
+  {
+    char buf[BLOCK_SIZE];
+    if (read_block(path[*depth], buf) < 0)
+    {
+      return E_UNKNOWN;
+    }
+    struct block *blk = (struct block *)buf;
+    int i = find_entry(blk, component);
+    if (i < 0)
+    {
+      return E_NOT_EXISTS;
+    }
+    block_num_t child = (blk->contents).dirnode.entries[i].block_num;
+    if (is_dir(child) == FALSE)
+    {
+      return E_NOT_DIR;
+    }
+    path[++*depth] = child;
+    component = next;
+  }
+
+  if (strlen(component) > MAX_NAME_LENGTH)
+  {
+    return E_MAX_NAME_LENGTH;
+  }
+  strcpy(name, component);
+  return E_SUCCESS;
+}
+
+// writes the changed directory block at path[level], and then each of its
+// ancestors below path[top] pointed at the copy below it, to new blocks:
+// copies[j] takes the place of path[top + 1 + j].  top_buf (the block at
+// path[top]) is pointed at the highest copy but not written, so none of the
+// copies are reachable until it is.
+static int shadow_path(const block_num_t *path, int level, int top, char *buf,
+                       char *top_buf, const block_num_t *copies)
+{
+  char parent_buf[BLOCK_SIZE];
+  int c;
+  for (c = 0; level - c > top; c++)
+  {
+    block_num_t copy = copies[level - top - 1 - c];
+    if (write_block(copy, buf) < 0)
+    {
+      return E_UNKNOWN;
+    }
+    buf = level - c - 1 == top ? top_buf : parent_buf;
+    if (buf == parent_buf && read_block(path[level - c - 1], parent_buf) < 0)
+    {
+      return E_UNKNOWN;
+    }
+    struct block *parent = (struct block *)buf;
+    int i;
+    for (i = 0; i < (parent->contents).dirnode.num_entries; i++)
+    {
+      if ((parent->contents).dirnode.entries[i].block_num == path[level - c])
+      {
+        (parent->contents).dirnode.entries[i].block_num = copy;
+      }
+    }
+  }
+  return E_SUCCESS;
+}
+
+/* jfs_rename
+ *   renames a file or directory, possibly moving it to another directory;
+ *   only the directory entries change, the data is not copied.  Either
+ *   way the rename takes effect with a single block write, so a crash
+ *   leaves the entry in one directory or the other: across directories both
+ *   are changed in copies (see shadow_path()), which the lowest directory
+ *   on both paths is then written to point at.
+ * old_path - path of the file or directory to rename ("name", "dir/name" or
+ *   "/dir/name"; relative paths start at the current directory)
+ * new_path - its new path, which must not exist yet
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS, E_EXISTS, E_NOT_DIR, E_MAX_NAME_LENGTH, E_MAX_DIR_ENTRIES,
+ *   E_DISK_FULL, E_INVALID (moving a directory into itself)
+ */
+static int do_rename(const char *old_path, const char *new_path)
+{
+  block_num_t src_path[NUM_BLOCKS];
+  block_num_t dst_path[NUM_BLOCKS];
+  int src_depth, dst_depth;
+  char src_name[MAX_NAME_LENGTH + 1];
+  char dst_name[MAX_NAME_LENGTH + 1];
+  int ret = resolve_parent(old_path, src_path, &src_depth, src_name);
+  if (ret == E_SUCCESS)
+  {
+    ret = resolve_parent(new_path, dst_path, &dst_depth, dst_name);
+  }
+  if (ret < 0)
+  {
+    return ret;
+  }
+
+  char src_buf[BLOCK_SIZE];
+  if (read_block(src_path[src_depth], src_buf) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  struct block *src = (struct block *)src_buf;
+  int i = find_entry(src, src_name);
+  if (i < 0)
+  {
+    return E_NOT_EXISTS;
+  }
+  block_num_t moved = (src->contents).dirnode.entries[i].block_num;
+
+  if (src_path[src_depth] == dst_path[dst_depth])
+  {
+    // same directory: just change the name
+    int j = find_entry(src, dst_name);
+    if (j >= 0)
+    {
+      return j == i ? E_SUCCESS : E_EXISTS;
+    }
+    strcpy((src->contents).dirnode.entries[i].name, dst_name);
+    return write_path(src_path, src_depth, src_buf);
+  }
+
+  // a directory moved below itself would be cut off from the tree
+  int k;
+  for (k = 0; k <= dst_depth; k++)
+  {
+    if (dst_path[k] == moved)
+    {
+      return E_INVALID;
+    }
+  }
+  char dst_buf[BLOCK_SIZE];
+  if (read_block(dst_path[dst_depth], dst_buf) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  struct block *dst = (struct block *)dst_buf;
+  if (find_entry(dst, dst_name) >= 0)
+  {
+    return E_EXISTS;
+  }
+  uint16_t num_entries = (dst->contents).dirnode.num_entries;
+  if (num_entries == MAX_DIR_ENTRIES)
+  {
+    return E_MAX_DIR_ENTRIES;
+  }
+
+  // the lowest directory on both paths; the directories below it on either
+  // path are copied, and writing it switches to the copies
+  int top = 0;
+  while (top < src_depth && top < dst_depth && src_path[top + 1] == dst_path[top + 1])
+  {
+    top++;
+  }
+  int num_copies = src_depth + dst_depth - 2 * top;
+  // the top directory and its ancestors may have to be copied too
+  int needed = num_copies + (bfs_num_snapshots() > 0 ? top + 1 : 0);
+  if (needed > bfs_free_blocks())
+  {
+    return E_DISK_FULL;
+  }
+
+  (dst->contents).dirnode.entries[num_entries].block_num = moved;
+  strcpy((dst->contents).dirnode.entries[num_entries].name, dst_name);
+  (dst->contents).dirnode.num_entries += 1;
+  num_entries = (src->contents).dirnode.num_entries;
+  memmove(&(src->contents).dirnode.entries[i], &(src->contents).dirnode.entries[i + 1],
+          (num_entries - i - 1) * sizeof((src->contents).dirnode.entries[0]));
+  (src->contents).dirnode.num_entries -= 1;
+
+  char top_buf[BLOCK_SIZE];
+  char *top_dir = top_buf;
+  if (top == src_depth)
+  {
+    top_dir = src_buf;
+  }
+  else if (top == dst_depth)
+  {
+    top_dir = dst_buf;
+  }
+  else if (read_block(src_path[top], top_buf) < 0)
+  {
+    return E_UNKNOWN;
+  }
+
+  // copies[] and replaced[] list the old path's blocks below the top, then
+  // the new path's
+  block_num_t copies[NUM_BLOCKS];
+  block_num_t replaced[NUM_BLOCKS];
+  memcpy(replaced, &src_path[top + 1], (src_depth - top) * sizeof(block_num_t));
+  memcpy(&replaced[src_depth - top], &dst_path[top + 1], (dst_depth - top) * sizeof(block_num_t));
+  if (allocate_blocks(num_copies, copies) < 0)
+  {
+    return E_DISK_FULL;
+  }
+  if (shadow_path(src_path, src_depth, top, src_buf, top_dir, copies) < 0 ||
+      shadow_path(dst_path, dst_depth, top, dst_buf, top_dir, &copies[src_depth - top]) < 0)
+  {
+    release_blocks(num_copies, copies);
+    return E_UNKNOWN;
+  }
+  ret = write_path(src_path, top, top_dir);
+  if (ret < 0)
+  {
+    release_blocks(num_copies, copies);
+    return ret;
+  }
+
+  // the rename has taken effect; the current directory's path may run
+  // through the copies
+  int c;
+  for (c = 0; c < num_copies; c++)
+  {
+    for (k = 0; k <= dir_depth; k++)
+    {
+      if (dir_path[k] == replaced[c])
+      {
+        dir_path[k] = copies[c];
+      }
+    }
+  }
+  current_dir = dir_path[dir_depth];
+  if (release_blocks(num_copies, replaced) < 0)
+  {
+    return E_UNKNOWN;
+  }
+
+  // if the current directory was moved along, its path now goes through the
+  // new directory
+  for (k = 1; k <= dir_depth && dir_path[k] != moved; k++)
+  {
+  }
+  if (k <= dir_depth)
+  {
+    // the new path cannot be relative to the moved current directory, so
+    // it can be followed again
+    ret = resolve_parent(new_path, dst_path, &dst_depth, dst_name);
+    if (ret < 0)
+    {
+      return E_UNKNOWN;
+    }
+    block_num_t below[NUM_BLOCKS];
+    int num_below = dir_depth - k;
+    memcpy(below, &dir_path[k + 1], num_below * sizeof(block_num_t));
+    memcpy(dir_path, dst_path, (dst_depth + 1) * sizeof(block_num_t));
+    dir_path[dst_depth + 1] = moved;
+    memcpy(&dir_path[dst_depth + 2], below, num_below * sizeof(block_num_t));
+    dir_depth = dst_depth + 1 + num_below;
+  }
+  return E_SUCCESS;
+}
+
+/* jfs_statfs
+ *   returns the file system stats (see struct fs_stats for details); this
+ *   does not access the disk
+ * buf - pointer to a struct fs_stats (already allocated by the caller) where
+ *   the stats will be written
+ * returns 0 on success (this function should always succeed)
+ */
+int jfs_statfs(struct fs_stats *buf)
+{
+  buf->block_size = BLOCK_SIZE;
+  buf->num_blocks = bfs_num_blocks();
+  buf->free_blocks = bfs_free_blocks();
+  return E_SUCCESS;
+}
+
+/* jfs_snapshot
+ *   creates a named snapshot of the whole file system.  This is O(1): the
+ *   snapshot shares every block with the live tree, and blocks are copied
+ *   only when the live tree next changes them.
+ * snapshot_name - name of the new snapshot
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_EXISTS, E_MAX_NAME_LENGTH, E_MAX_SNAPSHOTS, E_DISK_FULL
+ */
+static int do_snapshot(const char *snapshot_name)
+{
+  if (strlen(snapshot_name) > MAX_NAME_LENGTH)
+  {
+    return E_MAX_NAME_LENGTH;
+  }
+  if (bfs_find_snapshot(snapshot_name) >= 0)
+  {
+    return E_EXISTS;
+  }
+  if (bfs_num_snapshots() == MAX_SNAPSHOTS)
+  {
+    return E_MAX_SNAPSHOTS;
+  }
+  // the snapshot's bitmap copy, plus the snapshot table for the first one
+  if (bfs_free_blocks() < 2)
+  {
+    return E_DISK_FULL;
+  }
+  if (bfs_snapshot(snapshot_name) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  return E_SUCCESS;
+}
+
+/* jfs_rollback
+ *   makes the file system the way it was when the snapshot was created,
+ *   discarding later changes; the snapshot itself is kept, and the current
+ *   directory becomes the root directory
+ * snapshot_name - name of the snapshot to roll back to
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS
+ */
+static int do_rollback(const char *snapshot_name)
+{
+  int index = bfs_find_snapshot(snapshot_name);
+  if (index < 0)
+  {
+    return E_NOT_EXISTS;
+  }
+  if (bfs_rollback(index) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  dir_depth = 0;
+  current_dir = dir_path[0] = bfs_root();
+  // the snapshot's tree may share data blocks differently than the tree that
+  // was discarded
+  dedup_reset();
+  if (bfs_refcount_table() != 0)
+  {
+    return recount_refs();
+  }
+  return E_SUCCESS;
+}
+
+/* jfs_delete_snapshot
+ *   deletes a snapshot, freeing the blocks that only it was using
+ * snapshot_name - name of the snapshot to delete
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_NOT_EXISTS
+ */
+static int do_delete_snapshot(const char *snapshot_name)
+{
+  int index = bfs_find_snapshot(snapshot_name);
+  if (index < 0)
+  {
+    return E_NOT_EXISTS;
+  }
+  if (bfs_delete_snapshot(index) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  return E_SUCCESS;
+}
+
+/* jfs_list_snapshots
+ *   finds the names of all the snapshots
+ * snapshot_names - array of strings; the function will set the strings in
+ *   the array, followed by a NULL pointer after the last valid string; the
+ *   strings are malloced and the caller will free them
+ * returns 0 on success (this function should always succeed)
+ */
+int jfs_list_snapshots(char *snapshot_names[MAX_SNAPSHOTS + 1])
+{
+  int num_snapshots = bfs_num_snapshots();
+  int i;
+  for (i = 0; i < num_snapshots; i++)
+  {
+    snapshot_names[i] = strdup(bfs_snapshot_name(i));
+  }
+  snapshot_names[num_snapshots] = NULL;
+  return E_SUCCESS;
+}
+
+/* jfs_set_dedup
+ *   turns deduplication of full data blocks on or off.  While it is on,
+ *   jfs_write() stores a block identical to one already in the file system
+ *   by sharing that block; a shared block is only freed when the last file
+ *   using it is removed.  The setting is saved in the image.  Blocks already
+ *   shared stay shared when it is turned off.
+ * enable - nonzero to turn dedup on, 0 to turn it off
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_DISK_FULL (no room for the reference count table)
+ */
+static int do_set_dedup(int enable)
+{
+  if (enable && bfs_refcount_table() == 0 && bfs_free_blocks() < REFCOUNT_BLOCKS)
+  {
+    return E_DISK_FULL;
+  }
+  if (bfs_set_feature(FEATURE_DEDUP, enable) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  dedup_reset();
+  return E_SUCCESS;
+}
+
+/* jfs_set_compression
+ *   turns compression of new files on or off.  Files created while it is on
+ *   are compressed for good: jfs_write() compresses them and jfs_read()
+ *   decompresses them, and jfs_stat() reports both their size and the
+ *   (smaller) number of bytes stored.  The setting is saved in the image.
+ * enable - nonzero to turn compression on, 0 to turn it off
+ * returns 0 on success (this function should always succeed)
+ */
+static int do_set_compression(int enable)
+{
+  if (bfs_set_feature(FEATURE_COMPRESS, enable) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  return E_SUCCESS;
+}
+
+// The measured jfs_* functions (documented above, at their do_* versions)
+// only add their calls to the per-operation counters and to the trace being
+// recorded, if any; see op_stats.h and trace.h
+
+int jfs_mkdir(const char *directory_name)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_mkdir(directory_name);
+  op_end(OP_MKDIR, &timer, ret, 0);
+  struct trace_args args = {{directory_name, NULL}, {0, 0}, NULL, 0};
+  trace_call(OP_MKDIR, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_chdir(const char *directory_name)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_chdir(directory_name);
+  op_end(OP_CHDIR, &timer, ret, 0);
+  struct trace_args args = {{directory_name, NULL}, {0, 0}, NULL, 0};
+  trace_call(OP_CHDIR, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_ls(char *directories[MAX_DIR_ENTRIES + 1], char *files[MAX_DIR_ENTRIES + 1])
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_ls(directories, files);
+  op_end(OP_LS, &timer, ret, 0);
+  trace_call(OP_LS, &timer, ret, NULL);
+  return ret;
+}
+
+int jfs_ls_packed(char names[LS_PACKED_SIZE], int *num_directories, int *num_files)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_ls_packed(names, num_directories, num_files);
+  op_end(OP_LS, &timer, ret, 0);
+  trace_call(OP_LS, &timer, ret, NULL);
+  return ret;
+}
+
+int jfs_rmdir(const char *directory_name)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_rmdir(directory_name);
+  op_end(OP_RMDIR, &timer, ret, 0);
+  struct trace_args args = {{directory_name, NULL}, {0, 0}, NULL, 0};
+  trace_call(OP_RMDIR, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_creat(const char *file_name)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_creat(file_name);
+  op_end(OP_CREAT, &timer, ret, 0);
+  struct trace_args args = {{file_name, NULL}, {0, 0}, NULL, 0};
+  trace_call(OP_CREAT, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_remove(const char *file_name)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_remove(file_name);
+  op_end(OP_REMOVE, &timer, ret, 0);
+  struct trace_args args = {{file_name, NULL}, {0, 0}, NULL, 0};
+  trace_call(OP_REMOVE, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_rename(const char *old_path, const char *new_path)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_rename(old_path, new_path);
+  op_end(OP_RENAME, &timer, ret, 0);
+  struct trace_args args = {{old_path, new_path}, {0, 0}, NULL, 0};
+  trace_call(OP_RENAME, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_stat(const char *name, struct stats *buf)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_stat(name, buf);
+  op_end(OP_STAT, &timer, ret, 0);
+  struct trace_args args = {{name, NULL}, {0, 0}, NULL, 0};
+  trace_call(OP_STAT, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_write(const char *file_name, const void *buf, unsigned short count)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_write(file_name, buf, count);
+  op_end(OP_WRITE, &timer, ret, ret == E_SUCCESS ? count : 0);
+  struct trace_args args = {{file_name, NULL}, {0, 0}, buf, count};
+  trace_call(OP_WRITE, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_read(const char *file_name, void *buf, unsigned short *ptr_count)
+{
+  unsigned short size = *ptr_count; // before do_read() changes it
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_read(file_name, buf, ptr_count);
+  op_end(OP_READ, &timer, ret, ret == E_SUCCESS ? *ptr_count : 0);
+  struct trace_args args = {{file_name, NULL}, {size, 0}, NULL, 0};
+  trace_call(OP_READ, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_truncate(const char *file_name, unsigned short size)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_truncate(file_name, size);
+  op_end(OP_TRUNCATE, &timer, ret, 0);
+  struct trace_args args = {{file_name, NULL}, {size, 0}, NULL, 0};
+  trace_call(OP_TRUNCATE, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_punch_hole(const char *file_name, unsigned short offset, unsigned short length)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_punch_hole(file_name, offset, length);
+  op_end(OP_PUNCH_HOLE, &timer, ret, 0);
+  struct trace_args args = {{file_name, NULL}, {offset, length}, NULL, 0};
+  trace_call(OP_PUNCH_HOLE, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_remove_tree(const char *name)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_remove_tree(name);
+  op_end(OP_REMOVE_TREE, &timer, ret, 0);
+  struct trace_args args = {{name, NULL}, {0, 0}, NULL, 0};
+  trace_call(OP_REMOVE_TREE, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_du(const char *name, struct du_stats *buf)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_du(name, buf);
+  op_end(OP_DU, &timer, ret, 0);
+  struct trace_args args = {{name, NULL}, {0, 0}, NULL, 0};
+  trace_call(OP_DU, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_walk(jfs_visitor_t visitor, void *arg)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_walk(visitor, arg);
+  op_end(OP_WALK, &timer, ret, 0);
+  trace_call(OP_WALK, &timer, ret, NULL);
+  return ret;
+}
+
+int jfs_snapshot(const char *snapshot_name)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_snapshot(snapshot_name);
+  op_end(OP_SNAPSHOT, &timer, ret, 0);
+  struct trace_args args = {{snapshot_name, NULL}, {0, 0}, NULL, 0};
+  trace_call(OP_SNAPSHOT, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_rollback(const char *snapshot_name)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_rollback(snapshot_name);
+  op_end(OP_ROLLBACK, &timer, ret, 0);
+  struct trace_args args = {{snapshot_name, NULL}, {0, 0}, NULL, 0};
+  trace_call(OP_ROLLBACK, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_delete_snapshot(const char *snapshot_name)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_delete_snapshot(snapshot_name);
+  op_end(OP_DELETE_SNAPSHOT, &timer, ret, 0);
+  struct trace_args args = {{snapshot_name, NULL}, {0, 0}, NULL, 0};
+  trace_call(OP_DELETE_SNAPSHOT, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_set_dedup(int enable)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_set_dedup(enable);
+  op_end(OP_SET_DEDUP, &timer, ret, 0);
+  struct trace_args args = {{NULL, NULL}, {enable != 0, 0}, NULL, 0};
+  trace_call(OP_SET_DEDUP, &timer, ret, &args);
+  return ret;
+}
+
+int jfs_set_compression(int enable)
+{
+  struct op_timer timer;
+  op_begin(&timer);
+  int ret = do_set_compression(enable);
+  op_end(OP_SET_COMPRESSION, &timer, ret, 0);
+  struct trace_args args = {{NULL, NULL}, {enable != 0, 0}, NULL, 0};
+  trace_call(OP_SET_COMPRESSION, &timer, ret, &args);
+  return ret;
+}
+
+/* jfs_set_checksums
+ *   turns per-block checksums on or off.  While they are on, every block
+ *   written gets a CRC-32C in a checksum area of the image, and a block read
+ *   from the disk that does not match it makes the jfs_* function reading it
+ *   fail with E_UNKNOWN instead of using corrupt data (jfsck reports such
+ *   blocks).  The setting is saved in the image.
+ * enable - nonzero to turn checksums on, 0 to turn them off
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_UNKNOWN (the checksum area could not be written)
+ */
+int jfs_set_checksums(int enable)
+{
+  if (raw_set_checksums(enable) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  return E_SUCCESS;
+}
+
+/* jfs_set_read_threads
+ *   sets how many threads jfs_read() uses to read the data blocks of a file,
+ *   until jfs_unmount().  With more than one, the blocks are split into runs
+ *   of consecutive blocks that a pool of num_threads - 1 workers and the
+ *   calling thread read at the same time, which pays off for large files on
+ *   fast disks when the block cache is off (see raw_set_cache()).
+ * num_threads - from 1 (the default: no workers) to MAX_READ_THREADS
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_INVALID, E_UNKNOWN (the workers could not be started)
+ */
+int jfs_set_read_threads(int num_threads)
+{
+  if (num_threads < 1 || num_threads > MAX_READ_THREADS)
+  {
+    return E_INVALID;
+  }
+  stop_read_workers();
+  while (read_pool.num_workers < num_threads - 1)
+  {
+    if (pthread_create(&read_pool.workers[read_pool.num_workers], NULL, read_worker, NULL) != 0)
+    {
+      stop_read_workers();
+      return E_UNKNOWN;
+    }
+    read_pool.num_workers++;
+  }
+  return E_SUCCESS;
+}
+
+/* jfs_set_prefetch
+ *   turns directory prefetching on or off (it starts out off).  While it is
+ *   on, jfs_chdir() starts reading the inode or directory block of every
+ *   entry of the new directory into the block cache in the background, with
+ *   one syscall for each run of nearby blocks, so that a following ls or
+ *   stat does not wait for them one by one.  Turning it on also turns on the
+ *   block cache (see raw_set_cache()), which stays on when it is turned off.
+ * enable - nonzero to turn prefetching on, 0 to turn it off
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_UNKNOWN (the block cache could not be turned on)
+ */
+int jfs_set_prefetch(int enable)
+{
+  if (enable != 0 && raw_set_cache(1) < 0)
+  {
+    return E_UNKNOWN;
+  }
+  prefetch_on = enable != 0 ? TRUE : FALSE;
+  return E_SUCCESS;
+}
+
+/* jfs_print_stats
+ *   writes the per-operation counters and latency percentiles
+ * out - where to write them
+ * json - nonzero for a JSON object, 0 for a table
+ * returns 0 on success (this function should always succeed)
+ */
+int jfs_print_stats(FILE *out, int json)
+{
+  if (json)
+  {
+    op_print_json(out);
+  }
+  else
+  {
+    op_print(out);
+  }
+  return E_SUCCESS;
+}
+
+/* jfs_reset_stats
+ *   clears the per-operation counters
+ * returns 0 on success (this function should always succeed)
+ */
+int jfs_reset_stats()
+{
+  op_reset();
+  return E_SUCCESS;
+}
+
+/* jfs_set_stats_file
+ *   makes jfs_unmount() write the per-operation counters as JSON to a file
+ * filename - the file (replaced if it exists), or NULL for none
+ * returns 0 on success (this function should always succeed)
+ */
+int jfs_set_stats_file(const char *filename)
+{
+  free(stats_filename);
+  stats_filename = filename != NULL ? strdup(filename) : NULL;
+  return E_SUCCESS;
+}
+
+/* jfs_set_trace_file
+ *   starts recording every measured jfs_* call, with its arguments and
+ *   timing, to a trace file that jfs_replay can play back; recording stops
+ *   at jfs_unmount()
+ * filename - the file (replaced if it exists), or NULL to stop recording
+ * returns 0 on success or one of the following error codes on failure:
+ *   E_UNKNOWN (the file could not be written)
+ */
+int jfs_set_trace_file(const char *filename)
+{
+  int ret = filename != NULL ? trace_open(filename) : trace_close();
+  return ret < 0 ? E_UNKNOWN : E_SUCCESS;
+}
+
+/* jfs_unmount
+ *   makes the file system no longer accessible (unless it is mounted again).
+ *   This should be called exactly once after all other jfs_* operations are
+ *   complete; it is invalid to call any other jfs_* function (except
+ *   jfs_mount) after this function complete.  Basically, this closes the DISK
+ *   file on the _real_ file system.  If your code requires any clean up after
+ *   all other jfs_* functions are done, you may add it here.
+ * returns 0 on success or -1 on error; errors should only occur due to
+ *   errors in the underlying disk syscalls.
+ */
+int jfs_unmount()
+{
+  if (stats_filename != NULL)
+  {
+    FILE *out = fopen(stats_filename, "w");
+    if (out != NULL)
+    {
+      op_print_json(out);
+      fclose(out);
+    }
+  }
+  trace_close();
+  stop_read_workers();
   int ret = bfs_unmount();
   return ret;
 }
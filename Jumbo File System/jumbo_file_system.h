@@ -1,6 +1,7 @@
 #ifndef _JUMBO_FILE_SYSTEM_H_
 #define _JUMBO_FILE_SYSTEM_H_
 
+#include <stdio.h>
 #include "basic_file_system.h"
 
 
@@ -8,14 +9,30 @@
 #define MAX_NAME_LENGTH 7
 
 // maximum number of (combined total) files and subdirectories that can be in a directory
-#define MAX_DIR_ENTRIES ((BLOCK_SIZE - sizeof(uint16_t) - sizeof(uint32_t)) / (sizeof(block_num_t) + MAX_NAME_LENGTH + 1))
+#define MAX_DIR_ENTRIES ((BLOCK_SIZE - 3 * sizeof(uint16_t)) / (sizeof(block_num_t) + MAX_NAME_LENGTH + 1))
 
 // maximum number of data blocks that can be used to store a file
-#define MAX_DATA_BLOCKS ((BLOCK_SIZE - sizeof(uint32_t) - sizeof(uint32_t)) / sizeof(block_num_t))
+#define MAX_DATA_BLOCKS ((BLOCK_SIZE - 4 * sizeof(uint16_t)) / sizeof(block_num_t))
 
 // maximum size (in bytes) that a file can be
 #define MAX_FILE_SIZE (MAX_DATA_BLOCKS * BLOCK_SIZE)
 
+// files up to this size (in bytes) are stored inline in the inode, in the
+// space otherwise used by data_blocks, and have no data blocks
+#define MAX_INLINE_SIZE (MAX_DATA_BLOCKS * sizeof(block_num_t))
+
+// longest path jfs_walk() passes to a visitor (not counting '\0')
+#define MAX_PATH_LENGTH (NUM_BLOCKS * (MAX_NAME_LENGTH + 1))
+
+// most threads jfs_read() can use (see jfs_set_read_threads())
+#define MAX_READ_THREADS 16
+
+// bytes jfs_ls_packed() may need: every name in a directory, with its '\0'
+#define LS_PACKED_SIZE (MAX_DIR_ENTRIES * (MAX_NAME_LENGTH + 1))
+
+// values of block.flags (bit flags)
+#define INODE_COMPRESSED 0x1 // file data is compressed (see jfs_set_compression())
+
 
 // Struct returned by jfs_stat()
 struct stats {
@@ -24,17 +41,46 @@ struct stats {
   block_num_t block_num;          // of the dir block, or the inode (for regular files)
   uint16_t num_data_blocks;       // not counting the inode (ignored if is_dir is 0)
   uint32_t file_size;             // in bytes (ignored if is_dir is 0)
+  uint32_t physical_size;         // bytes actually stored, after compression and without holes (ignored if is_dir is 0)
+};
+
+// Struct returned by jfs_du()
+struct du_stats {
+  uint32_t num_dirs;   // directories, including the one measured
+  uint32_t num_files;  // regular files
+  uint32_t file_bytes; // total size of the files, in bytes
+  uint32_t num_blocks; // directory blocks, inodes and data blocks
+};
+
+// Called by jfs_walk() for each file and directory; path is relative to the
+// current directory.  Returning anything but 0 stops the walk.  The visitor
+// must not change the file system.
+typedef int (*jfs_visitor_t)(const char* path, const struct stats* st, void* arg);
+
+// Struct returned by jfs_statfs()
+struct fs_stats {
+  uint32_t block_size;     // in bytes
+  block_num_t num_blocks;  // total blocks on the disk, including metadata blocks
+  block_num_t free_blocks; // blocks not yet allocated
 };
 
 
 // This is the data stored in an inode or directory block (dirnode)
 struct block {
-  uint32_t is_dir; // 0 if it is a directory, 1 if it is a regular file
+  uint16_t is_dir; // 0 if it is a directory, 1 if it is a regular file
+  uint16_t flags;  // INODE_* flags (0 for directories)
 
   union {
     struct {
-      uint32_t file_size; // in bytes
-      block_num_t data_blocks[MAX_DATA_BLOCKS];
+      uint16_t file_size;   // in bytes
+      uint16_t stored_size; // compressed bytes stored, or 0 if the data is
+                            // stored as is; only used with INODE_COMPRESSED
+      // the data stored (file_size bytes, or stored_size if that is not 0)
+      // is inline if it fits, and in data blocks otherwise
+      union {
+        block_num_t data_blocks[MAX_DATA_BLOCKS]; // if more than MAX_INLINE_SIZE bytes are stored
+        char data[MAX_INLINE_SIZE];               // if at most MAX_INLINE_SIZE bytes are stored
+      };
     } inode;
 
     struct {
@@ -54,14 +100,43 @@ int jfs_mount (const char* filename);
 int jfs_mkdir (const char* directory_name);
 int jfs_chdir (const char* directory_name);
 int jfs_ls (char* directories[MAX_DIR_ENTRIES+1], char* files[MAX_DIR_ENTRIES+1]);
+int jfs_ls_packed (char names[LS_PACKED_SIZE], int* num_directories, int* num_files);
 int jfs_rmdir (const char* directory_name);
 
 int jfs_creat  (const char* file_name);
 int jfs_remove (const char* file_name);
+int jfs_rename (const char* old_path, const char* new_path);
 int jfs_stat   (const char* name, struct stats* buf);
 int jfs_write  (const char* file_name, const void* buf, unsigned short count);
 int jfs_read   (const char* file_name, void* buf, unsigned short* ptr_count);
 
+int jfs_truncate   (const char* file_name, unsigned short size);
+int jfs_punch_hole (const char* file_name, unsigned short offset, unsigned short length);
+
+int jfs_remove_tree (const char* name);
+int jfs_du          (const char* name, struct du_stats* buf);
+int jfs_walk        (jfs_visitor_t visitor, void* arg);
+
+int jfs_statfs (struct fs_stats* buf);
+
+int jfs_snapshot        (const char* snapshot_name);
+int jfs_rollback        (const char* snapshot_name);
+int jfs_delete_snapshot (const char* snapshot_name);
+int jfs_list_snapshots  (char* snapshot_names[MAX_SNAPSHOTS+1]);
+
+int jfs_set_dedup       (int enable);
+int jfs_set_compression (int enable);
+int jfs_set_checksums   (int enable);
+int jfs_set_read_threads (int num_threads);
+int jfs_set_prefetch     (int enable);
+
+int jfs_print_stats    (FILE* out, int json);
+int jfs_reset_stats    ();
+int jfs_set_stats_file (const char* filename);
+int jfs_set_trace_file (const char* filename);
+
+const char* jfs_strerror (int err);
+
 int jfs_unmount();
 
 
@@ -77,5 +152,7 @@ int jfs_unmount();
 #define E_MAX_DIR_ENTRIES -8 // the operation would cause the maximum number of entries in a directory to be exceeded
 #define E_MAX_FILE_SIZE -9   // the operation would cause the maximum file size to be exceeded
 #define E_DISK_FULL -10      // the disk is full (or the operation would require more capacity than remains on the disk)
+#define E_MAX_SNAPSHOTS -11  // the operation would cause the maximum number of snapshots to be exceeded
+#define E_INVALID -12        // the operation makes no sense (e.g. moving a directory into itself)
 
 #endif // _JUMBO_FILE_SYSTEM_H_
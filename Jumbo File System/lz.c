@@ -0,0 +1,112 @@
+#include "lz.h"
+#include <stdint.h>
+#include <string.h>
+
+#define MIN_MATCH 3
+#define MAX_MATCH (MIN_MATCH + 15)
+#define MAX_OFFSET 2048
+#define MAX_LITERALS 128
+#define HASH_BITS 10
+
+
+// hash of the MIN_MATCH bytes at p
+static unsigned hash3(const unsigned char* p) {
+  uint32_t v = (uint32_t) p[0] << 16 | (uint32_t) p[1] << 8 | p[2];
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+
+// appends literal runs for len bytes of src; returns the new output length
+// or -1 if they do not fit
+static int put_literals(const unsigned char* src, int len,
+                        unsigned char* out, int n, int capacity) {
+  while (len > 0) {
+    int run = len < MAX_LITERALS ? len : MAX_LITERALS;
+    if (n + 1 + run > capacity) {
+      return -1;
+    }
+    out[n++] = run - 1;
+    memcpy(out + n, src, run);
+    n += run;
+    src += run;
+    len -= run;
+  }
+  return n;
+}
+
+
+int lz_compress(const void* src, int len, void* dst, int capacity) {
+  const unsigned char* in = (const unsigned char*) src;
+  unsigned char* out = (unsigned char*) dst;
+  // last position where each hash of MIN_MATCH bytes was seen
+  int table[1 << HASH_BITS];
+  memset(table, -1, sizeof(table));
+
+  int n = 0;
+  int pos = 0;
+  int literal_start = 0;
+  while (pos + MIN_MATCH <= len) {
+    unsigned h = hash3(in + pos);
+    int candidate = table[h];
+    table[h] = pos;
+    if (candidate < 0 || pos - candidate > MAX_OFFSET ||
+        memcmp(in + candidate, in + pos, MIN_MATCH) != 0) {
+      pos++;
+      continue;
+    }
+
+    // greedy: take the longest match at this candidate (it may overlap pos)
+    int match = MIN_MATCH;
+    while (match < MAX_MATCH && pos + match < len && in[candidate + match] == in[pos + match]) {
+      match++;
+    }
+    n = put_literals(in + literal_start, pos - literal_start, out, n, capacity);
+    if (n < 0 || n + 2 > capacity) {
+      return -1;
+    }
+    int offset = pos - candidate - 1;
+    out[n++] = 0x80 | (match - MIN_MATCH) << 3 | offset >> 8;
+    out[n++] = offset & 0xff;
+
+    for (int i = 1; i < match && pos + i + MIN_MATCH <= len; i++) {
+      table[hash3(in + pos + i)] = pos + i;
+    }
+    pos += match;
+    literal_start = pos;
+  }
+  return put_literals(in + literal_start, len - literal_start, out, n, capacity);
+}
+
+
+int lz_decompress(const void* src, int len, void* dst, int capacity) {
+  const unsigned char* in = (const unsigned char*) src;
+  unsigned char* out = (unsigned char*) dst;
+  int i = 0;
+  int n = 0;
+  while (i < len) {
+    unsigned token = in[i++];
+    if (token < 0x80) {
+      int run = token + 1;
+      if (i + run > len || n + run > capacity) {
+        return -1;
+      }
+      memcpy(out + n, in + i, run);
+      i += run;
+      n += run;
+    } else {
+      if (i == len) {
+        return -1;
+      }
+      int match = ((token >> 3) & 0x0f) + MIN_MATCH;
+      int offset = ((token & 0x07) << 8 | in[i++]) + 1;
+      if (offset > n || n + match > capacity) {
+        return -1;
+      }
+      // byte by byte, since the match may overlap the bytes it produces
+      for (int k = 0; k < match; k++, n++) {
+        out[n] = out[n - offset];
+      }
+    }
+  }
+  return n;
+}
@@ -0,0 +1,26 @@
+#ifndef _LZ_H_
+#define _LZ_H_
+
+/* A small LZ77-style codec for file data.  The compressed stream is a
+ * sequence of tokens:
+ *   0xxxxxxx              literal run: the next x+1 bytes (1..128) are copied
+ *   1llllooo oooooooo     match: copy l+3 bytes (3..18) starting o+1 bytes
+ *                         (1..2048) back in the output
+ */
+
+/* lz_compress
+ *   compresses len bytes of src into dst
+ * capacity - size of dst; compression gives up once the output would not fit
+ * returns the compressed length, or -1 if it would be more than capacity
+ */
+int lz_compress(const void* src, int len, void* dst, int capacity);
+
+/* lz_decompress
+ *   decompresses a stream made by lz_compress()
+ * capacity - size of dst
+ * returns the decompressed length, or -1 if the stream is corrupt or the
+ *   output would be more than capacity
+ */
+int lz_decompress(const void* src, int len, void* dst, int capacity);
+
+#endif
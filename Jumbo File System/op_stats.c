@@ -0,0 +1,151 @@
+#include "op_stats.h"
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#define SUB_BUCKET_BITS 3
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+// values below 2 * SUB_BUCKETS get a bucket each; after that, SUB_BUCKETS
+// buckets per power of two up to 2^64
+#define NUM_BUCKETS ((64 - SUB_BUCKET_BITS) * SUB_BUCKETS + SUB_BUCKETS)
+
+struct op_counters {
+  uint64_t calls;
+  uint64_t errors;
+  uint64_t block_reads;
+  uint64_t block_writes;
+  uint64_t bytes;
+  uint64_t allocations;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t histogram[NUM_BUCKETS];
+};
+
+static const char* op_names[NUM_OPS] = {
+  "mkdir", "chdir", "ls", "rmdir", "creat", "remove", "rename", "stat",
+  "write", "read", "truncate", "punch_hole", "remove_tree", "du", "walk",
+  "snapshot", "rollback", "delete_snapshot", "set_dedup", "set_compression",
+};
+
+static struct op_counters counters[NUM_OPS];
+
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// histogram bucket of a latency
+static int bucket_of(uint64_t value) {
+  if (value < 2 * SUB_BUCKETS) {
+    return value;
+  }
+  int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+  return shift * SUB_BUCKETS + (value >> shift);
+}
+
+// largest latency that falls in a bucket
+static uint64_t bucket_high(int bucket) {
+  if (bucket < 2 * SUB_BUCKETS) {
+    return bucket;
+  }
+  int shift = bucket / SUB_BUCKETS - 1;
+  uint64_t mantissa = bucket % SUB_BUCKETS + SUB_BUCKETS;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+// latency below which the given fraction of the calls fall (an upper bound,
+// accurate to the bucket)
+static uint64_t percentile(const struct op_counters* c, double fraction) {
+  uint64_t target = (uint64_t) (fraction * c->calls + 0.5);
+  if (target < 1) {
+    target = 1;
+  }
+  uint64_t seen = 0;
+  for (int b = 0; b < NUM_BUCKETS; b++) {
+    seen += c->histogram[b];
+    if (seen >= target) {
+      return bucket_high(b) < c->max_ns ? bucket_high(b) : c->max_ns;
+    }
+  }
+  return c->max_ns;
+}
+
+
+void op_begin(struct op_timer* timer) {
+  raw_get_stats(&timer->raw);
+  timer->allocations = bfs_num_allocations();
+  timer->start_ns = now_ns();
+}
+
+
+void op_end(int op, struct op_timer* timer, int ret, uint64_t bytes) {
+  uint64_t elapsed = now_ns() - timer->start_ns;
+  timer->elapsed_ns = elapsed;
+  struct raw_stats raw;
+  raw_get_stats(&raw);
+
+  struct op_counters* c = &counters[op];
+  c->calls++;
+  if (ret < 0) {
+    c->errors++;
+  }
+  c->block_reads += raw.block_reads - timer->raw.block_reads;
+  c->block_writes += raw.block_writes - timer->raw.block_writes;
+  c->bytes += bytes;
+  c->allocations += bfs_num_allocations() - timer->allocations;
+  c->total_ns += elapsed;
+  if (elapsed > c->max_ns) {
+    c->max_ns = elapsed;
+  }
+  c->histogram[bucket_of(elapsed)]++;
+}
+
+
+void op_reset() {
+  memset(counters, 0, sizeof(counters));
+}
+
+
+void op_print(FILE* out) {
+  fprintf(out, "%-16s %8s %7s %8s %9s %9s %7s %9s %9s %9s %9s %9s\n",
+          "op", "calls", "errors", "reads/op", "writes/op", "bytes", "allocs",
+          "p50(us)", "p90(us)", "p99(us)", "p99.9(us)", "max(us)");
+  for (int op = 0; op < NUM_OPS; op++) {
+    const struct op_counters* c = &counters[op];
+    if (c->calls == 0) {
+      continue;
+    }
+    fprintf(out, "%-16s %8" PRIu64 " %7" PRIu64 " %8.2f %9.2f %9" PRIu64 " %7" PRIu64 " %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+            op_names[op], c->calls, c->errors,
+            (double) c->block_reads / c->calls, (double) c->block_writes / c->calls,
+            c->bytes, c->allocations,
+            percentile(c, 0.5) / 1e3, percentile(c, 0.9) / 1e3,
+            percentile(c, 0.99) / 1e3, percentile(c, 0.999) / 1e3, c->max_ns / 1e3);
+  }
+}
+
+
+void op_print_json(FILE* out) {
+  fprintf(out, "{\n  \"ops\": {");
+  int first = 1;
+  for (int op = 0; op < NUM_OPS; op++) {
+    const struct op_counters* c = &counters[op];
+    if (c->calls == 0) {
+      continue;
+    }
+    fprintf(out, "%s\n    \"%s\": {\"calls\": %" PRIu64 ", \"errors\": %" PRIu64 ", "
+            "\"block_reads\": %" PRIu64 ", \"block_writes\": %" PRIu64 ", "
+            "\"bytes\": %" PRIu64 ", \"allocations\": %" PRIu64 ", "
+            "\"latency_ns\": {\"mean\": %" PRIu64 ", \"p50\": %" PRIu64 ", \"p90\": %" PRIu64 ", "
+            "\"p99\": %" PRIu64 ", \"p999\": %" PRIu64 ", \"max\": %" PRIu64 "}}",
+            first ? "" : ",", op_names[op], c->calls, c->errors,
+            c->block_reads, c->block_writes, c->bytes, c->allocations,
+            c->total_ns / c->calls, percentile(c, 0.5), percentile(c, 0.9),
+            percentile(c, 0.99), percentile(c, 0.999), c->max_ns);
+    first = 0;
+  }
+  fprintf(out, "\n  }\n}\n");
+}
@@ -0,0 +1,76 @@
+#ifndef _OP_STATS_H_
+#define _OP_STATS_H_
+
+#include <stdio.h>
+#include "basic_file_system.h"
+
+/* Counters and latency histograms for each jfs_* operation.  Every measured
+ * call is bracketed by op_begin() and op_end(); block I/O is taken from the
+ * raw disk layer's counters and allocations from the basic file system's.
+ * Latencies go into HDR-style histograms: exact up to 16ns, then 8 buckets
+ * per power of two, so any value is recorded within 12.5%.
+ */
+
+// the measured operations
+enum op_type {
+  OP_MKDIR,
+  OP_CHDIR,
+  OP_LS,
+  OP_RMDIR,
+  OP_CREAT,
+  OP_REMOVE,
+  OP_RENAME,
+  OP_STAT,
+  OP_WRITE,
+  OP_READ,
+  OP_TRUNCATE,
+  OP_PUNCH_HOLE,
+  OP_REMOVE_TREE,
+  OP_DU,
+  OP_WALK,
+  OP_SNAPSHOT,
+  OP_ROLLBACK,
+  OP_DELETE_SNAPSHOT,
+  OP_SET_DEDUP,
+  OP_SET_COMPRESSION,
+  NUM_OPS
+};
+
+// counters at the start of an operation (see op_begin())
+struct op_timer {
+  uint64_t start_ns;
+  struct raw_stats raw;
+  uint64_t allocations;
+  uint64_t elapsed_ns; // set by op_end()
+};
+
+/* op_begin
+ *   records the time and I/O counters at the start of an operation
+ */
+void op_begin(struct op_timer* timer);
+
+/* op_end
+ *   adds an operation that started at op_begin() to its counters
+ * op - one of the OP_* values
+ * ret - the operation's return value (negative means it failed)
+ * bytes - file data read or written by the operation
+ */
+void op_end(int op, struct op_timer* timer, int ret, uint64_t bytes);
+
+/* op_reset
+ *   clears all counters and histograms
+ */
+void op_reset();
+
+/* op_print
+ *   writes a table with a line for each operation that was called
+ */
+void op_print(FILE* out);
+
+/* op_print_json
+ *   writes all counters as a JSON object (operations that were never called
+ *   are left out)
+ */
+void op_print_json(FILE* out);
+
+#endif
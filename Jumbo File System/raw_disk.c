@@ -1,12 +1,210 @@
 #include "raw_disk.h"
+#include "crc32c.h"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/file.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <pthread.h>
+
+// dirty blocks at most this many clean cached blocks apart are written with
+// one syscall, rewriting the clean blocks between them
+#define MAX_WRITE_GAP 4
+
+// hot blocks at most this many blocks apart are prefetched with one syscall
+#define MAX_PREFETCH_GAP 4
+
+// appended to the image's name to get its warmup file, which lists the
+// blocks used while it was last mounted with the cache on; it starts with
+// WARM_MAGIC and the number of blocks, followed by their numbers
+#define WARM_SUFFIX ".warm"
+#define WARM_MAGIC 0x4d52574a // "JWRM"
+
+// size of the blocks themselves; the checksum area (see raw_set_checksums())
+// follows them: a CRC-32C for every block, then CHECKSUM_MAGIC
+#define IMAGE_SIZE ((off_t)NUM_BLOCKS * BLOCK_SIZE)
+#define CHECKSUM_MAGIC 0x4352434a // "JCRC"
 
 static const char* disk_filename = NULL;
 static int disk_fd = -1;
+static int read_only = 0; // mounted with raw_mount_readonly()
+static struct raw_stats stats;
+
+// block cache (see raw_set_cache()); the whole image fits, so nothing is
+// ever evicted, and cached blocks sit at the same offsets as on the disk
+enum cache_state { NOT_CACHED, CLEAN, DIRTY };
+static int cache_on = 0;
+static int in_batch = 0;
+static char cache[NUM_BLOCKS][BLOCK_SIZE];
+static uint8_t cache_state[NUM_BLOCKS];
+static uint32_t num_uses[NUM_BLOCKS]; // reads and writes since the mount
+
+// guards the cache against the prefetch thread: a block is only ever
+// prefetched into a slot that is still NOT_CACHED
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t prefetch_thread;
+static int prefetching = 0;
+static int num_prefetched = 0;
+static block_num_t prefetch_list[NUM_BLOCKS]; // blocks the thread reads
+static size_t prefetch_count = 0;
+static char warm_filename[PATH_MAX];
+
+static int checksums_on = 0;
+static uint32_t checksums[NUM_BLOCKS]; // a copy of the checksum area
+
+
+// adds n to an I/O counter; read_blocks() may be called from several threads
+static void add_stat(uint64_t* counter, uint64_t n) {
+  __atomic_add_fetch(counter, n, __ATOMIC_RELAXED);
+}
+
+
+// whether a block read from the disk matches its checksum
+static int checksum_ok(block_num_t block_num, const void* buf) {
+  return !checksums_on || crc32c(buf, BLOCK_SIZE) == checksums[block_num];
+}
+
+
+/* write_checksums
+ *   writes the checksums of a run of blocks to the checksum area
+ * returns 0 on success or -1 on failure
+ */
+static int write_checksums(block_num_t first_block, int num_blocks) {
+  if (!checksums_on) {
+    return 0;
+  }
+  add_stat(&stats.syscalls, 1);
+  size_t len = num_blocks * sizeof(uint32_t);
+  ssize_t ret = pwrite(disk_fd, &checksums[first_block], len,
+                       IMAGE_SIZE + first_block * sizeof(uint32_t));
+  return ret >= 0 && (size_t)ret == len ? 0 : -1;
+}
+
+
+/* load_checksums
+ *   turns checksums on if the image has a checksum area
+ * returns 0 on success or -1 on failure
+ */
+static int load_checksums(off_t file_size) {
+  uint32_t magic;
+  checksums_on = 0;
+  if (file_size != IMAGE_SIZE + (off_t)sizeof(checksums) + (off_t)sizeof(magic)) {
+    return 0;
+  }
+  if (pread(disk_fd, &magic, sizeof(magic), IMAGE_SIZE + sizeof(checksums)) != sizeof(magic)) {
+    return -1;
+  }
+  if (magic == CHECKSUM_MAGIC) {
+    if (pread(disk_fd, checksums, sizeof(checksums), IMAGE_SIZE) != sizeof(checksums)) {
+      return -1;
+    }
+    checksums_on = 1;
+  }
+  return 0;
+}
+
+
+static int compare_blocks(const void* a, const void* b) {
+  return *(const block_num_t*) a - *(const block_num_t*) b;
+}
+
+
+/* prefetch
+ *   reads the blocks in prefetch_list into the cache, in runs of nearby
+ *   blocks in ascending order, while the mounted image is already in use.
+ *   These reads are left out of the I/O counters, which measure what the
+ *   file system asks for (see raw_prefetched_blocks()).
+ */
+static void* prefetch(void* arg) {
+  (void) arg;
+  block_num_t* blocks = prefetch_list;
+  size_t count = prefetch_count;
+  qsort(blocks, count, sizeof(block_num_t), compare_blocks);
+
+  static char buf[NUM_BLOCKS][BLOCK_SIZE];
+  size_t i = 0;
+  while (i < count && blocks[i] < NUM_BLOCKS) {
+    size_t j = i + 1;
+    while (j < count && blocks[j] < NUM_BLOCKS && blocks[j] - blocks[j - 1] <= MAX_PREFETCH_GAP) {
+      j++;
+    }
+    block_num_t first = blocks[i];
+    size_t len = (size_t)(blocks[j - 1] - first + 1) * BLOCK_SIZE;
+    ssize_t ret = pread(disk_fd, buf, len, (off_t)first * BLOCK_SIZE);
+    if (ret < 0 || (size_t)ret != len) {
+      break;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    for (size_t b = 0; b < len / BLOCK_SIZE; b++) {
+      // a block that fails its checksum is left for read_block() to report
+      if (cache_state[first + b] == NOT_CACHED && checksum_ok(first + b, buf[b])) {
+        memcpy(cache[first + b], buf[b], BLOCK_SIZE);
+        cache_state[first + b] = CLEAN;
+        num_prefetched++;
+      }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    i = j;
+  }
+  return NULL;
+}
+
+
+/* prefetch_warm
+ *   prefetches the blocks listed in the warmup file
+ */
+static void* prefetch_warm(void* arg) {
+  FILE* in = fopen(warm_filename, "rb");
+  if (NULL == in) {
+    return NULL;
+  }
+  uint32_t header[2];
+  prefetch_count = 0;
+  if (fread(header, sizeof(header), 1, in) == 1 && header[0] == WARM_MAGIC) {
+    prefetch_count = fread(prefetch_list, sizeof(block_num_t),
+                           header[1] < NUM_BLOCKS ? header[1] : NUM_BLOCKS, in);
+  }
+  fclose(in);
+  return prefetch(arg);
+}
+
+
+/* save_warm_list
+ *   writes the warmup file: every block used since the mount
+ */
+static int save_warm_list() {
+  block_num_t blocks[NUM_BLOCKS];
+  uint32_t header[2] = {WARM_MAGIC, 0};
+  for (int b = 0; b < NUM_BLOCKS; b++) {
+    if (num_uses[b] > 0) {
+      blocks[header[1]++] = b;
+    }
+  }
+  FILE* out = fopen(warm_filename, "wb");
+  if (NULL == out) {
+    return -1;
+  }
+  fwrite(header, sizeof(header), 1, out);
+  fwrite(blocks, sizeof(block_num_t), header[1], out);
+  return fclose(out) == 0 ? 0 : -1;
+}
+
+
+/* start_mount
+ *   resets the per-mount state once the image is open
+ */
+static void start_mount(const char* filename) {
+  disk_filename = filename;
+  memset(cache_state, NOT_CACHED, sizeof(cache_state));
+  memset(num_uses, 0, sizeof(num_uses));
+  snprintf(warm_filename, sizeof(warm_filename), "%s%s", filename, WARM_SUFFIX);
+  num_prefetched = 0;
+}
 
 
 int raw_mount(const char* filename) {
@@ -15,6 +213,12 @@ int raw_mount(const char* filename) {
   if (disk_fd < 0) {
     return -1;
   }
+  // a second process using the image at the same time would corrupt it
+  if (flock(disk_fd, LOCK_EX | LOCK_NB) < 0) {
+    close(disk_fd);
+    disk_fd = -1;
+    return -1;
+  }
 
   // check the file size
   off_t file_size = lseek(disk_fd, 0, SEEK_END);
@@ -42,12 +246,56 @@ int raw_mount(const char* filename) {
     free(buffer);
   }
 
-  disk_filename = filename;
+  if (load_checksums(file_size) < 0) {
+    close(disk_fd);
+    disk_fd = -1;
+    return -1;
+  }
+
+  read_only = 0;
+  start_mount(filename);
+  if (cache_on) {
+    prefetching = pthread_create(&prefetch_thread, NULL, prefetch_warm, NULL) == 0;
+  }
+  return 0;
+}
+
+
+int raw_mount_readonly(const char* filename) {
+  // no lock: a process that has the image mounted holds it exclusively
+  disk_fd = open(filename, O_RDONLY);
+  if (disk_fd < 0) {
+    return -1;
+  }
+  off_t file_size = lseek(disk_fd, 0, SEEK_END);
+  if (file_size < NUM_BLOCKS * BLOCK_SIZE || load_checksums(file_size) < 0) {
+    close(disk_fd);
+    disk_fd = -1;
+    return -1;
+  }
+
+  read_only = 1;
+  start_mount(filename);
   return 0;
 }
 
 
 int read_block(block_num_t block_num, void* buf) {
+  if (cache_on) {
+    pthread_mutex_lock(&cache_lock);
+    num_uses[block_num]++;
+    int hit = cache_state[block_num] != NOT_CACHED;
+    if (hit) {
+      memcpy(buf, cache[block_num], BLOCK_SIZE);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (hit) {
+      add_stat(&stats.cache_hits, 1);
+      return 0;
+    }
+  }
+  add_stat(&stats.syscalls, 2);
+  add_stat(&stats.block_reads, 1);
   // go to the block
   if (lseek(disk_fd, block_num * BLOCK_SIZE, SEEK_SET) < 0) {
     return -1;
@@ -57,11 +305,38 @@ int read_block(block_num_t block_num, void* buf) {
   if (ret != BLOCK_SIZE) {
     return -1;
   }
+  if (!checksum_ok(block_num, buf)) {
+    add_stat(&stats.checksum_failures, 1);
+    return -1;
+  }
+  if (cache_on) {
+    pthread_mutex_lock(&cache_lock);
+    if (cache_state[block_num] == NOT_CACHED) {
+      memcpy(cache[block_num], buf, BLOCK_SIZE);
+      cache_state[block_num] = CLEAN;
+    }
+    pthread_mutex_unlock(&cache_lock);
+  }
   return 0;
 }
 
 
 int write_block(block_num_t block_num, void* buf) {
+  if (read_only) {
+    return -1;
+  }
+  uint32_t checksum = checksums_on ? crc32c(buf, BLOCK_SIZE) : 0;
+  if (cache_on && in_batch) {
+    pthread_mutex_lock(&cache_lock);
+    num_uses[block_num]++;
+    memcpy(cache[block_num], buf, BLOCK_SIZE);
+    cache_state[block_num] = DIRTY;
+    checksums[block_num] = checksum;
+    pthread_mutex_unlock(&cache_lock);
+    return 0;
+  }
+  add_stat(&stats.syscalls, 2);
+  add_stat(&stats.block_writes, 1);
   // go to the block
   if (lseek(disk_fd, block_num * BLOCK_SIZE, SEEK_SET) < 0) {
     return -1;
@@ -71,11 +346,219 @@ int write_block(block_num_t block_num, void* buf) {
   if (ret != BLOCK_SIZE) {
     return -1;
   }
+  // write-through: the block is cached once it is on the disk, so the
+  // prefetch thread cannot cache an older copy after it
+  pthread_mutex_lock(&cache_lock);
+  checksums[block_num] = checksum;
+  if (cache_on) {
+    num_uses[block_num]++;
+    memcpy(cache[block_num], buf, BLOCK_SIZE);
+    cache_state[block_num] = CLEAN;
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return write_checksums(block_num, 1);
+}
+
+
+int read_blocks(block_num_t first_block, block_num_t num_blocks, void* buf) {
+  add_stat(&stats.syscalls, 1);
+  add_stat(&stats.block_reads, num_blocks);
+  size_t len = (size_t)num_blocks * BLOCK_SIZE;
+  ssize_t ret = pread(disk_fd, buf, len, (off_t)first_block * BLOCK_SIZE);
+  if (ret < 0 || (size_t)ret != len) {
+    return -1;
+  }
+  if (cache_on) {
+    pthread_mutex_lock(&cache_lock);
+  }
+  for (int i = 0; i < num_blocks; i++) {
+    block_num_t b = first_block + i;
+    char* block = (char*)buf + i * BLOCK_SIZE;
+    if (cache_on && cache_state[b] != NOT_CACHED) {
+      // cached blocks may be newer than the disk (inside a batch)
+      memcpy(block, cache[b], BLOCK_SIZE);
+    } else if (!checksum_ok(b, block)) {
+      // left out of the cache, so a later read_block() reports it too
+      add_stat(&stats.checksum_failures, 1);
+    } else if (cache_on) {
+      memcpy(cache[b], block, BLOCK_SIZE);
+      cache_state[b] = CLEAN;
+    }
+  }
+  if (cache_on) {
+    pthread_mutex_unlock(&cache_lock);
+  }
   return 0;
 }
 
 
+/* wait_for_prefetch
+ *   waits until the prefetch thread started by raw_mount() is done
+ */
+static void wait_for_prefetch() {
+  if (prefetching) {
+    pthread_join(prefetch_thread, NULL);
+    prefetching = 0;
+  }
+}
+
+
+int raw_set_cache(int enable) {
+  int ret = 0;
+  if (enable && cache_on) {
+    return 0;
+  }
+  wait_for_prefetch();
+  if (!enable && cache_on) {
+    ret = raw_end_batch();
+  }
+  cache_on = enable;
+  memset(cache_state, NOT_CACHED, sizeof(cache_state));
+  return ret;
+}
+
+
+void raw_begin_batch() {
+  in_batch = cache_on;
+}
+
+
+int raw_end_batch() {
+  in_batch = 0;
+  int ret = 0;
+  int b = 0;
+  pthread_mutex_lock(&cache_lock);
+  while (b < NUM_BLOCKS) {
+    if (cache_state[b] != DIRTY) {
+      b++;
+      continue;
+    }
+    // extend the run over later dirty blocks, and over short gaps of clean
+    // blocks between them
+    int end = b + 1;
+    int next = end;
+    while (next < NUM_BLOCKS && next - end < MAX_WRITE_GAP) {
+      if (cache_state[next] == DIRTY) {
+        end = ++next;
+      } else if (cache_state[next] == CLEAN) {
+        next++;
+      } else {
+        break;
+      }
+    }
+
+    size_t len = (size_t)(end - b) * BLOCK_SIZE;
+    add_stat(&stats.syscalls, 1);
+    add_stat(&stats.block_writes, end - b);
+    ssize_t written = pwrite(disk_fd, cache[b], len, (off_t)b * BLOCK_SIZE);
+    if (written < 0 || (size_t)written != len || write_checksums(b, end - b) < 0) {
+      // the blocks stay dirty, so the next batch tries again
+      ret = -1;
+    } else {
+      memset(cache_state + b, CLEAN, end - b);
+    }
+    b = end;
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return ret;
+}
+
+
+int raw_set_checksums(int enable) {
+  wait_for_prefetch();
+  if (raw_end_batch() < 0) {
+    return -1;
+  }
+  if (!enable) {
+    checksums_on = 0;
+    return ftruncate(disk_fd, IMAGE_SIZE);
+  }
+  if (checksums_on) {
+    return 0;
+  }
+
+  static char image[NUM_BLOCKS][BLOCK_SIZE];
+  if (pread(disk_fd, image, IMAGE_SIZE, 0) != IMAGE_SIZE) {
+    return -1;
+  }
+  for (int b = 0; b < NUM_BLOCKS; b++) {
+    checksums[b] = crc32c(image[b], BLOCK_SIZE);
+  }
+  uint32_t magic = CHECKSUM_MAGIC;
+  if (pwrite(disk_fd, checksums, sizeof(checksums), IMAGE_SIZE) != sizeof(checksums) ||
+      pwrite(disk_fd, &magic, sizeof(magic), IMAGE_SIZE + sizeof(checksums)) != sizeof(magic)) {
+    return -1;
+  }
+  checksums_on = 1;
+  return 0;
+}
+
+
+int raw_has_checksums() {
+  return checksums_on;
+}
+
+
+int raw_verify_block(block_num_t block_num, const void* buf) {
+  return checksum_ok(block_num, buf);
+}
+
+
+int raw_prefetch(const block_num_t* blocks, int num_blocks) {
+  if (!cache_on) {
+    return 0;
+  }
+  // one prefetch at a time; the thread owns prefetch_list while it runs
+  wait_for_prefetch();
+  prefetch_count = 0;
+  for (int i = 0; i < num_blocks; i++) {
+    if (blocks[i] < NUM_BLOCKS && cache_state[blocks[i]] == NOT_CACHED) {
+      prefetch_list[prefetch_count++] = blocks[i];
+    }
+  }
+  if (0 == prefetch_count) {
+    return 0;
+  }
+  prefetching = pthread_create(&prefetch_thread, NULL, prefetch, NULL) == 0;
+  return prefetching ? 0 : -1;
+}
+
+
+int raw_prefetched_blocks() {
+  wait_for_prefetch();
+  return num_prefetched;
+}
+
+
+void raw_get_stats(struct raw_stats* out) {
+  out->block_reads = __atomic_load_n(&stats.block_reads, __ATOMIC_RELAXED);
+  out->block_writes = __atomic_load_n(&stats.block_writes, __ATOMIC_RELAXED);
+  out->syscalls = __atomic_load_n(&stats.syscalls, __ATOMIC_RELAXED);
+  out->cache_hits = __atomic_load_n(&stats.cache_hits, __ATOMIC_RELAXED);
+  out->checksum_failures = __atomic_load_n(&stats.checksum_failures, __ATOMIC_RELAXED);
+}
+
+
+void raw_reset_stats() {
+  __atomic_store_n(&stats.block_reads, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&stats.block_writes, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&stats.syscalls, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&stats.cache_hits, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&stats.checksum_failures, 0, __ATOMIC_RELAXED);
+}
+
+
 int raw_unmount() {
+  wait_for_prefetch();
+  if (raw_end_batch() < 0) {
+    close(disk_fd);
+    return -1;
+  }
+  if (cache_on && !read_only) {
+    // only a hint for the next mount, so failing to write it is no error
+    save_warm_list();
+  }
   disk_filename = NULL;
+  read_only = 0;
   return close(disk_fd);
 }
@@ -3,7 +3,16 @@
 
 #include <stdint.h>
 
+// bytes per block; can be set at build time (make BLOCK_SIZE=256) to a power
+// of two from 64 to 256, past which a maximum size file no longer fits in
+// the unsigned short counts jfs_read() and jfs_write() take.  Images made
+// with one block size cannot be mounted with another.
+#ifndef BLOCK_SIZE
 #define BLOCK_SIZE 64
+#endif
+#if BLOCK_SIZE < 64 || BLOCK_SIZE > 256 || (BLOCK_SIZE & (BLOCK_SIZE - 1)) != 0
+#error "BLOCK_SIZE must be 64, 128 or 256"
+#endif
 #define NUM_BLOCKS (8 * BLOCK_SIZE)
 
 // block_num_t is the data type for a block number
@@ -11,10 +20,34 @@
 typedef uint16_t block_num_t;
 
 
+// I/O counters kept by the raw disk layer (see raw_get_stats())
+struct raw_stats {
+  uint64_t block_reads;  // blocks read from the DISK file
+  uint64_t block_writes; // blocks written to the DISK file
+  uint64_t syscalls;     // syscalls made on the DISK file by reads and writes
+  uint64_t cache_hits;   // blocks read from the block cache instead
+  uint64_t checksum_failures; // blocks read that did not match their checksum
+};
+
+
+/* raw_mount
+ *   opens the DISK file, creating it if it does not exist; only one process
+ *   at a time can have it mounted
+ * returns 0 on success or -1 on failure
+ */
 int raw_mount(const char* filename);
 
+/* raw_mount_readonly
+ *   opens an existing DISK file for reading only: it is neither created,
+ *   extended nor locked, so it can be read while another process has it
+ *   mounted (and is changing it); write_block() fails until raw_unmount()
+ * returns 0 on success or -1 on failure
+ */
+int raw_mount_readonly(const char* filename);
+
 /* read_block
- *   reads a block from the disk
+ *   reads a block from the disk (failing if it does not match its checksum;
+ *   see raw_set_checksums())
  * block_num - number of the block to read
  * buf - data read from disk will be copied into this buffer
  * (precondition: buf is BLOCK_SIZE bytes long)
@@ -31,6 +64,98 @@ int read_block(block_num_t block_num, void* buf);
  */
 int write_block(block_num_t block_num, void* buf);
 
+/* read_blocks
+ *   reads num_blocks consecutive blocks with a single syscall; safe to call
+ *   from several threads at once.  A block that does not match its
+ *   checksum is counted and kept out of the cache, but still copied into
+ *   buf: the caller checks each one (see raw_verify_block()).
+ * first_block - number of the first block to read
+ * num_blocks - number of blocks to read
+ * buf - data read from disk will be copied into this buffer
+ * (precondition: buf is num_blocks * BLOCK_SIZE bytes long)
+ * returns 0 on success or -1 on failure
+ */
+int read_blocks(block_num_t first_block, block_num_t num_blocks, void* buf);
+
+/* raw_set_cache
+ *   turns the block cache on or off (it starts out off).  The cache keeps a
+ *   copy of every block read or written, so later reads of it make no
+ *   syscalls; writes still go straight to the disk except inside a batch.
+ *   Turning it off ends any batch and forgets the cached blocks; turning it
+ *   on while it is on does nothing.
+ *   While the cache is on, raw_unmount() saves the blocks that were used in
+ *   a warmup file next to the image, and raw_mount() starts a thread that
+ *   reads them back into the cache, so turn it on before mounting.
+ * enable - nonzero to turn the cache on, 0 to turn it off
+ * returns 0 on success or -1 on failure
+ */
+int raw_set_cache(int enable);
+
+/* raw_begin_batch
+ *   starts holding written blocks in the block cache instead of writing them
+ *   to the disk, until raw_end_batch(); a block written several times in a
+ *   batch reaches the disk once.  Does nothing if the cache is off.
+ */
+void raw_begin_batch();
+
+/* raw_end_batch
+ *   writes the blocks held since raw_begin_batch() to the disk, with one
+ *   syscall for each run of nearby blocks
+ * returns 0 on success or -1 on failure
+ */
+int raw_end_batch();
+
+/* raw_set_checksums
+ *   turns per-block checksums on or off (they start out the way the image
+ *   was left).  While they are on, a CRC-32C of every block is kept in a
+ *   checksum area after the last block; write_block() updates it and
+ *   read_block() checks blocks read from the disk against it.
+ * enable - nonzero to turn checksums on, 0 to turn them off (which removes
+ *   the checksum area)
+ * returns 0 on success or -1 on failure
+ */
+int raw_set_checksums(int enable);
+
+/* raw_has_checksums
+ *   returns 1 if the image has per-block checksums, or 0 if not
+ */
+int raw_has_checksums();
+
+/* raw_verify_block
+ *   checks a block read with read_blocks() against its checksum
+ * returns 1 if it matches or the image has no checksums, or 0 if not
+ */
+int raw_verify_block(block_num_t block_num, const void* buf);
+
+/* raw_prefetch
+ *   starts reading blocks into the cache in the background, with one syscall
+ *   for each run of nearby blocks, after waiting for any earlier prefetch
+ *   to finish.  Blocks already cached are skipped, and nothing is done if
+ *   the cache is off.
+ * blocks - numbers of the blocks to read, in any order
+ * num_blocks - how many there are
+ * returns 0 on success or -1 on failure
+ */
+int raw_prefetch(const block_num_t* blocks, int num_blocks);
+
+/* raw_prefetched_blocks
+ *   waits for the blocks being prefetched (those listed in the warmup file,
+ *   or passed to raw_prefetch()) to be in the cache
+ * returns how many were read in the background since the mount
+ */
+int raw_prefetched_blocks();
+
+/* raw_get_stats
+ *   copies the I/O counters accumulated since the last raw_reset_stats()
+ * stats - pointer to a struct raw_stats (allocated by the caller)
+ */
+void raw_get_stats(struct raw_stats* stats);
+
+/* raw_reset_stats
+ *   sets all I/O counters back to zero
+ */
+void raw_reset_stats();
+
 int raw_unmount();
 
 #endif // _RAW_DISK_H_
@@ -0,0 +1,73 @@
+#include "trace.h"
+#include <string.h>
+
+#define TRACE_BUFFER_SIZE 65536
+
+static FILE* trace_file = NULL;
+static uint64_t first_start_ns;
+static int have_first;
+
+
+int trace_open(const char* filename) {
+  if (trace_close() < 0) {
+    return -1;
+  }
+  trace_file = fopen(filename, "wb");
+  if (NULL == trace_file) {
+    return -1;
+  }
+  setvbuf(trace_file, NULL, _IOFBF, TRACE_BUFFER_SIZE);
+  have_first = 0;
+  struct trace_header header = {TRACE_MAGIC, TRACE_VERSION, BLOCK_SIZE};
+  if (fwrite(&header, sizeof(header), 1, trace_file) != 1) {
+    fclose(trace_file);
+    trace_file = NULL;
+    return -1;
+  }
+  return 0;
+}
+
+
+void trace_call(int op, const struct op_timer* timer, int ret, const struct trace_args* args) {
+  if (NULL == trace_file) {
+    return;
+  }
+  if (!have_first) {
+    first_start_ns = timer->start_ns;
+    have_first = 1;
+  }
+
+  struct trace_record rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.start_ns = timer->start_ns - first_start_ns;
+  rec.latency_ns = timer->elapsed_ns > UINT32_MAX ? UINT32_MAX : timer->elapsed_ns;
+  rec.op = op;
+  rec.ret = ret;
+  if (NULL != args) {
+    for (int i = 0; i < 2; i++) {
+      rec.arg[i] = args->arg[i];
+      rec.name_len[i] = NULL != args->name[i] ? strlen(args->name[i]) + 1 : 0;
+    }
+    rec.data_len = args->data_len;
+  }
+
+  fwrite(&rec, sizeof(rec), 1, trace_file);
+  for (int i = 0; i < 2; i++) {
+    if (rec.name_len[i] > 0) {
+      fwrite(args->name[i], 1, rec.name_len[i], trace_file);
+    }
+  }
+  if (rec.data_len > 0) {
+    fwrite(args->data, 1, rec.data_len, trace_file);
+  }
+}
+
+
+int trace_close() {
+  if (NULL == trace_file) {
+    return 0;
+  }
+  int ret = fclose(trace_file);
+  trace_file = NULL;
+  return ret == 0 ? 0 : -1;
+}
@@ -0,0 +1,66 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include "op_stats.h"
+
+/* Binary traces of jfs_* calls, for jfs_replay.  A trace is a struct
+ * trace_header followed by a struct trace_record for each call, in the order
+ * the calls were made.  Each record is followed by its strings (name_len[0]
+ * and then name_len[1] bytes, each including the '\0') and its data
+ * (data_len bytes, the data passed to jfs_write()).  Numbers are stored as
+ * they are in memory; traces are replayed on the machine that made them.
+ */
+
+#define TRACE_MAGIC 0x5453464a // "JFST"
+#define TRACE_VERSION 1
+
+struct trace_header {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t block_size; // BLOCK_SIZE of the file system that was traced
+};
+
+struct trace_record {
+  uint64_t start_ns;    // when the call started, since the first call
+  uint32_t latency_ns;  // how long it took
+  uint8_t op;           // one of the OP_* values
+  int8_t ret;           // what it returned
+  uint16_t arg[2];      // numeric arguments (see struct trace_args)
+  uint16_t name_len[2]; // bytes of each string, or 0 for NULL
+  uint16_t data_len;
+};
+
+/* Arguments of a call, as recorded:
+ *   name - file, directory or snapshot name (old and new path for rename)
+ *   arg - read: buffer size; truncate: size; punch_hole: offset, length;
+ *         set_dedup, set_compression: enable
+ *   data - write: the data written
+ */
+struct trace_args {
+  const char* name[2];
+  uint16_t arg[2];
+  const void* data;
+  uint16_t data_len;
+};
+
+/* trace_open
+ *   starts recording calls to a file (replaced if it exists), ending any
+ *   trace already being recorded
+ * returns 0 on success or -1 on failure
+ */
+int trace_open(const char* filename);
+
+/* trace_call
+ *   records a call measured with op_begin() and op_end(), if a trace is
+ *   being recorded
+ * args - the call's arguments, or NULL if it has none
+ */
+void trace_call(int op, const struct op_timer* timer, int ret, const struct trace_args* args);
+
+/* trace_close
+ *   stops recording, writing out what is still buffered
+ * returns 0 on success or -1 on failure
+ */
+int trace_close();
+
+#endif
@@ -1,62 +1,775 @@
+#define _GNU_SOURCE // pipe2()
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 
 #define arg_size 32
 #define pipe_size 32
+#define history_size 32
+#define job_size 64
 #define DELIMITER " \t\r\n\a"
 
-int exec_program(char **args)
+extern char **environ;
+
+// every line that was entered, for the history builtin
+char **history = NULL;
+int history_num = 0;
+int history_cap = 0;
+
+// a pipeline started by the shell, in the foreground or in the background
+// (with &); with job control it has its own process group
+#define stage_running 0
+#define stage_stopped 1
+#define stage_done 2
+
+struct stage
+{
+    pid_t pid;   // -1 if the program could not be started
+    int state;   // stage_running, stage_stopped or stage_done
+    int statloc; // waitpid() status once it is done
+};
+
+struct job
+{
+    int used;
+    pid_t pgid;      // 0 without job control
+    struct stage *stages;
+    int stage_num;
+    int background;
+    int order;       // when it was last started or stopped; the largest is the current job
+    int reported;    // its last change of state was printed
+    char *command;
+};
+
+// jobs[i] is job number i + 1.  The SIGCHLD handler updates the stages, so
+// the shell blocks SIGCHLD whenever it looks at the table.
+struct job jobs[job_size];
+int job_order = 0;
+
+int job_control = 0; // stdin is a terminal: jobs get process groups and the terminal
+pid_t shell_pgid;
+sigset_t sigchld_set;
+
+// records a change of state of a child; called from the SIGCHLD handler
+void update_job(pid_t pid, int statloc)
 {
-    int rc = fork();
-    if (rc < 0)
+    int i, j;
+    for (i = 0; i < job_size; i++)
     {
-        // fork failed; exit
-        fprintf(stderr, "fork failed\n");
-        exit(1);
+        for (j = 0; jobs[i].used && j < jobs[i].stage_num; j++)
+        {
+            struct stage *stage = &jobs[i].stages[j];
+            if (stage->pid != pid)
+                continue;
+            if (WIFSTOPPED(statloc))
+            {
+                stage->state = stage_stopped;
+            }
+            else if (WIFCONTINUED(statloc))
+            {
+                stage->state = stage_running;
+            }
+            else
+            {
+                stage->state = stage_done;
+                stage->statloc = statloc;
+            }
+            jobs[i].reported = 0;
+            return;
+        }
+    }
+}
+
+// reaps every child that has exited, stopped or continued
+void sigchld_handler(int sig)
+{
+    int saved_errno = errno;
+    int statloc;
+    pid_t pid;
+    while ((pid = waitpid(-1, &statloc, WNOHANG | WUNTRACED | WCONTINUED)) > 0)
+    {
+        update_job(pid, statloc);
+    }
+    errno = saved_errno;
+}
+
+void block_sigchld(sigset_t *old)
+{
+    sigprocmask(SIG_BLOCK, &sigchld_set, old);
+}
+
+void restore_sigmask(sigset_t *old)
+{
+    sigprocmask(SIG_SETMASK, old, NULL);
+}
+
+int job_running(struct job *job)
+{
+    int i;
+    for (i = 0; i < job->stage_num; i++)
+    {
+        if (job->stages[i].state == stage_running)
+            return 1;
+    }
+    return 0;
+}
+
+int job_done(struct job *job)
+{
+    int i;
+    for (i = 0; i < job->stage_num; i++)
+    {
+        if (job->stages[i].state != stage_done)
+            return 0;
+    }
+    return 1;
+}
+
+// the exit code of a job: that of its last stage, or 128 + the signal
+// that killed it
+int job_status(struct job *job)
+{
+    int statloc = job->stages[job->stage_num - 1].statloc;
+    if (WIFSIGNALED(statloc))
+        return 128 + WTERMSIG(statloc);
+    return WEXITSTATUS(statloc);
+}
+
+void free_job(struct job *job)
+{
+    free(job->stages);
+    free(job->command);
+    job->used = 0;
+}
+
+// the job fg and bg act on by default: the one started or stopped last
+struct job *current_job()
+{
+    struct job *current = NULL;
+    int i;
+    for (i = 0; i < job_size; i++)
+    {
+        if (jobs[i].used && (current == NULL || jobs[i].order > current->order))
+            current = &jobs[i];
+    }
+    return current;
+}
+
+void print_job(struct job *job, const char *state)
+{
+    printf("[%d]%c  %-10s %s%s\n", (int)(job - jobs) + 1, job == current_job() ? '+' : ' ',
+           state, job->command, job->background && job_running(job) ? " &" : "");
+}
+
+// sends a signal to every process of a job
+void signal_job(struct job *job, int sig)
+{
+    if (job->pgid > 0)
+    {
+        kill(-job->pgid, sig);
+        return;
+    }
+    int i;
+    for (i = 0; i < job->stage_num; i++)
+    {
+        if (job->stages[i].state != stage_done)
+            kill(job->stages[i].pid, sig);
+    }
+}
+
+// prints the background jobs that finished or stopped since the last prompt,
+// and forgets the finished ones (called with SIGCHLD blocked)
+void report_jobs()
+{
+    int i;
+    for (i = 0; i < job_size; i++)
+    {
+        struct job *job = &jobs[i];
+        if (!job->used || job->reported)
+            continue;
+        if (job_done(job))
+        {
+            if (job->background)
+            {
+                char state[32];
+                if (job_status(job) == 0)
+                    snprintf(state, sizeof(state), "Done");
+                else
+                    snprintf(state, sizeof(state), "Exit %d", job_status(job));
+                print_job(job, state);
+            }
+            free_job(job);
+        }
+        else if (!job_running(job))
+        {
+            job->order = ++job_order;
+            print_job(job, "Stopped");
+        }
+        job->reported = 1;
     }
-    else if (rc == 0)
+}
+
+// waits while a job runs in the foreground, with the terminal given to it
+// (called with SIGCHLD blocked; old is the mask to wait with)
+void wait_job(struct job *job, sigset_t *old)
+{
+    if (job_control && job->pgid > 0)
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    while (job_running(job))
+    {
+        sigsuspend(old);
+    }
+    if (job_control)
+        tcsetpgrp(STDIN_FILENO, shell_pgid);
+
+    if (job_done(job))
     {
-        // child (new process)
-        execvp(args[0], args);
-        printf("the command is wrong, please check!\n");
-        exit(127);
+        printf("jsh state: %d\n", job_status(job));
+        free_job(job);
     }
     else
     {
-        // parent goes down this path (original process)
-        sleep(1);
-        int statloc;
-        wait(&statloc);
-        // printf("jsh state: %d\n", statloc);
-        printf("jsh state: %d\n", WEXITSTATUS(statloc));
+        // stopped (^Z): it stays in the table for fg and bg
+        job->background = 1;
+        job->order = ++job_order;
+        job->reported = 1;
+        printf("\n");
+        print_job(job, "Stopped");
     }
+}
 
+// starts a program with in and out as its stdin and stdout (when they are
+// not 0 and 1).  posix_spawn() starts it without copying the shell's page
+// tables the way fork() does, so launching stays as fast however big the
+// shell grows; the pipe descriptors are close-on-exec (see run_job()), so
+// only the duplicated ones are left open in the new program.  With job
+// control it joins process group pgid, or starts its own if pgid is 0 (and
+// takes the terminal, if it is to run in the foreground).
+// returns its pid, or -1 if it could not be started
+pid_t launch(char **args, int in, int out, pid_t pgid, int foreground)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (in != 0)
+    {
+        posix_spawn_file_actions_adddup2(&actions, in, 0);
+    }
+    if (out != 1)
+    {
+        posix_spawn_file_actions_adddup2(&actions, out, 1);
+    }
+
+    // the shell blocks SIGCHLD while it starts a job, so the program gets an
+    // empty mask.  Signals ignored on entry stay ignored across exec, so with
+    // job control (where the shell ignores them itself) the program gets the
+    // default action for the job control signals back; otherwise it keeps
+    // whatever the shell was started with, like a command run from a script.
+    // SIGCHLD needs no reset: exec drops its handler anyway.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    if (job_control)
+    {
+        sigset_t defaults;
+        sigemptyset(&defaults);
+        sigaddset(&defaults, SIGINT);
+        sigaddset(&defaults, SIGQUIT);
+        sigaddset(&defaults, SIGTSTP);
+        sigaddset(&defaults, SIGTTIN);
+        sigaddset(&defaults, SIGTTOU);
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        flags |= POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, pgid);
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 35)
+        // take the terminal before the program runs, so it cannot be stopped
+        // for reading it first (the shell also hands it over, in wait_job())
+        if (foreground && pgid == 0)
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#endif
+#endif
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    pid_t pid;
+    int err = posix_spawnp(&pid, args[0], &actions, &attr, args, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
+
+// builtins run in the shell process itself: they return 0 to exit the
+// shell and 1 to read the next command, like exec_command()
+int jsh_exit(char **args);
+int jsh_cd(char **args);
+int jsh_pwd(char **args);
+int jsh_export(char **args);
+int jsh_unset(char **args);
+int jsh_type(char **args);
+int jsh_history(char **args);
+int jsh_jobs(char **args);
+int jsh_fg(char **args);
+int jsh_bg(char **args);
+int jsh_wait(char **args);
+
+struct builtin
+{
+    const char *name;
+    int (*func)(char **args);
+};
+
+struct builtin builtins[] = {
+    {"exit", jsh_exit},
+    {"cd", jsh_cd},
+    {"pwd", jsh_pwd},
+    {"export", jsh_export},
+    {"unset", jsh_unset},
+    {"type", jsh_type},
+    {"history", jsh_history},
+    {"jobs", jsh_jobs},
+    {"fg", jsh_fg},
+    {"bg", jsh_bg},
+    {"wait", jsh_wait},
+};
+#define builtin_num (sizeof(builtins) / sizeof(builtins[0]))
+
+// returns the builtin with this name, or NULL
+struct builtin *find_builtin(const char *name)
+{
+    int i;
+    for (i = 0; i < builtin_num; i++)
+    {
+        if (strcmp(builtins[i].name, name) == 0)
+        {
+            return &builtins[i];
+        }
+    }
+    return NULL;
+}
+
+int jsh_exit(char **args)
+{
+    return 0;
+}
+
+// cd with no directory goes to $HOME
+int jsh_cd(char **args)
+{
+    const char *dir = args[1] != NULL ? args[1] : getenv("HOME");
+    if (dir == NULL)
+    {
+        fprintf(stderr, "cd: HOME not set\n");
+    }
+    else if (chdir(dir) < 0)
+    {
+        perror(dir);
+    }
     return 1;
 }
 
-// this is used to certify whether it is exit command
-int exec_command(char **args)
+int jsh_pwd(char **args)
 {
-    char *exit_command = strdup("exit");
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL)
+    {
+        perror("pwd");
+        return 1;
+    }
+    printf("%s\n", cwd);
+    free(cwd);
+    return 1;
+}
 
-    if (args[0] == NULL || strlen(args[0]) == 0)
+// export NAME=value sets a variable for the commands run afterwards;
+// export alone lists them all
+int jsh_export(char **args)
+{
+    int i;
+    if (args[1] == NULL)
+    {
+        for (i = 0; environ[i] != NULL; i++)
+        {
+            printf("%s\n", environ[i]);
+        }
+        return 1;
+    }
+    for (i = 1; args[i] != NULL; i++)
+    {
+        char *value = strchr(args[i], '=');
+        if (value == NULL)
+        {
+            // already in the environment, or nothing to export
+            continue;
+        }
+        *value = '\0';
+        if (setenv(args[i], value + 1, 1) < 0)
+        {
+            perror("export");
+        }
+        *value = '=';
+    }
+    return 1;
+}
+
+int jsh_unset(char **args)
+{
+    int i;
+    for (i = 1; args[i] != NULL; i++)
+    {
+        if (unsetenv(args[i]) < 0)
+        {
+            perror("unset");
+        }
+    }
+    return 1;
+}
+
+// tells whether each name is a builtin or which program in $PATH runs it
+int jsh_type(char **args)
+{
+    int i;
+    for (i = 1; args[i] != NULL; i++)
+    {
+        if (find_builtin(args[i]) != NULL)
+        {
+            printf("%s is a shell builtin\n", args[i]);
+            continue;
+        }
+        if (strchr(args[i], '/') != NULL)
+        {
+            if (access(args[i], X_OK) == 0)
+                printf("%s is %s\n", args[i], args[i]);
+            else
+                printf("%s: not found\n", args[i]);
+            continue;
+        }
+
+        const char *path = getenv("PATH");
+        char *paths = strdup(path != NULL ? path : "/bin:/usr/bin");
+        char *rest = paths;
+        char *dir;
+        int found = 0;
+        while (!found && (dir = strsep(&rest, ":")) != NULL)
+        {
+            char file[4096];
+            struct stat st;
+            snprintf(file, sizeof(file), "%s/%s", strlen(dir) > 0 ? dir : ".", args[i]);
+            if (stat(file, &st) == 0 && S_ISREG(st.st_mode) && access(file, X_OK) == 0)
+            {
+                printf("%s is %s\n", args[i], file);
+                found = 1;
+            }
+        }
+        if (!found)
+        {
+            printf("%s: not found\n", args[i]);
+        }
+        free(paths);
+    }
+    return 1;
+}
+
+int jsh_history(char **args)
+{
+    int i;
+    for (i = 0; i < history_num; i++)
+    {
+        printf("%5d  %s\n", i + 1, history[i]);
+    }
+    return 1;
+}
+
+int jsh_jobs(char **args)
+{
+    sigset_t old;
+    block_sigchld(&old);
+    report_jobs();
+    int i;
+    for (i = 0; i < job_size; i++)
+    {
+        if (jobs[i].used)
+            print_job(&jobs[i], job_running(&jobs[i]) ? "Running" : "Stopped");
+    }
+    restore_sigmask(&old);
+    return 1;
+}
+
+// finds the job named by %n or n, or the current job if there is no name
+// (called with SIGCHLD blocked)
+struct job *find_job(const char *builtin, const char *name)
+{
+    if (name == NULL)
+    {
+        struct job *job = current_job();
+        if (job == NULL)
+            fprintf(stderr, "%s: no current job\n", builtin);
+        return job;
+    }
+    int n = atoi(name[0] == '%' ? name + 1 : name);
+    if (n < 1 || n > job_size || !jobs[n - 1].used)
+    {
+        fprintf(stderr, "%s: %s: no such job\n", builtin, name);
+        return NULL;
+    }
+    return &jobs[n - 1];
+}
+
+// fg [%n] brings a job to the foreground, continuing it if it is stopped
+int jsh_fg(char **args)
+{
+    sigset_t old;
+    block_sigchld(&old);
+    struct job *job = find_job("fg", args[1]);
+    if (job != NULL)
+    {
+        printf("%s\n", job->command);
+        int i;
+        for (i = 0; i < job->stage_num; i++)
+        {
+            if (job->stages[i].state == stage_stopped)
+                job->stages[i].state = stage_running;
+        }
+        job->background = 0;
+        if (job_control && job->pgid > 0)
+            tcsetpgrp(STDIN_FILENO, job->pgid);
+        signal_job(job, SIGCONT);
+        wait_job(job, &old);
+    }
+    restore_sigmask(&old);
+    return 1;
+}
+
+// bg [%n] continues a stopped job in the background
+int jsh_bg(char **args)
+{
+    sigset_t old;
+    block_sigchld(&old);
+    struct job *job = find_job("bg", args[1]);
+    if (job != NULL)
+    {
+        int i;
+        for (i = 0; i < job->stage_num; i++)
+        {
+            if (job->stages[i].state == stage_stopped)
+                job->stages[i].state = stage_running;
+        }
+        job->background = 1;
+        job->order = ++job_order;
+        signal_job(job, SIGCONT);
+        print_job(job, "Running");
+    }
+    restore_sigmask(&old);
+    return 1;
+}
+
+// wait [%n ...] waits for the given jobs, or for every running job, to
+// finish (or stop)
+int jsh_wait(char **args)
+{
+    sigset_t old;
+    block_sigchld(&old);
+    int i;
+    if (args[1] == NULL)
+    {
+        for (i = 0; i < job_size; i++)
+        {
+            while (jobs[i].used && job_running(&jobs[i]))
+                sigsuspend(&old);
+        }
+    }
+    for (i = 1; args[i] != NULL; i++)
+    {
+        struct job *job = find_job("wait", args[i]);
+        while (job != NULL && job_running(job))
+            sigsuspend(&old);
+    }
+    // the jobs waited for are not reported as done afterwards
+    for (i = 0; i < job_size; i++)
+    {
+        if (jobs[i].used && job_done(&jobs[i]))
+            free_job(&jobs[i]);
+    }
+    restore_sigmask(&old);
+    return 1;
+}
+
+// remembers a line for the history builtin (without its newline)
+void add_history(const char *line)
+{
+    size_t len = strcspn(line, "\n");
+    if (strspn(line, DELIMITER) >= len)
+    {
+        // only blanks
+        return;
+    }
+    if (history_num >= history_cap)
+    {
+        history_cap += history_size;
+        history = realloc(history, history_cap * sizeof(char *));
+        if (!history)
+        {
+            fprintf(stderr, "allocation space for history error\n");
+            exit(1);
+        }
+    }
+    history[history_num++] = strndup(line, len);
+}
+
+/* run_job
+ *   starts a pipeline as a new job, and waits for it unless it runs in the
+ *   background.  The pids are recorded in the job table as each stage is
+ *   started, with SIGCHLD blocked so that none is reaped before it is there.
+ * stages - the args of each stage
+ * num - number of stages
+ * background - nonzero to run it in the background (a line ending with &)
+ * command - the line, to show in jobs (kept by the job)
+ */
+void run_job(char ***stages, int num, int background, char *command)
+{
+    sigset_t old;
+    block_sigchld(&old);
+    report_jobs();
+
+    int n;
+    for (n = 0; n < job_size && jobs[n].used; n++)
+    {
+    }
+    if (n == job_size)
+    {
+        fprintf(stderr, "too many jobs\n");
+        free(command);
+        restore_sigmask(&old);
+        return;
+    }
+    struct job *job = &jobs[n];
+    memset(job, 0, sizeof(*job));
+    job->stages = malloc(num * sizeof(struct stage));
+    if (!job->stages)
+    {
+        fprintf(stderr, "allocation space for job error\n");
+        exit(1);
+    }
+    job->used = 1;
+    job->stage_num = num;
+    job->background = background;
+    job->order = ++job_order;
+    job->reported = 1;
+    job->command = command;
+
+    // set first process input
+    int i, in = 0, fd[2];
+    fflush(stdout);
+    for (i = 0; i < num; i++)
+    {
+        int out = 1;
+        if (i < num - 1)
+        {
+            // close-on-exec, so that each stage only has its own ends
+            int pp_res = pipe2(fd, O_CLOEXEC);
+            if (pp_res < 0)
+            {
+                printf("pipe function error\n");
+                exit(127);
+            }
+            out = fd[1];
+        }
+
+        // the first stage started leads the job's process group
+        struct stage *stage = &job->stages[i];
+        stage->pid = stages[i][0] != NULL ? launch(stages[i], in, out, job->pgid, !background) : -1;
+        if (stage->pid < 0)
+        {
+            printf(num == 1 ? "the command is wrong, please check!\n"
+                            : "the command between pipeline is wrong, please check!\n");
+        }
+        stage->state = stage->pid > 0 ? stage_running : stage_done;
+        stage->statloc = 127 << 8;
+        if (job_control && stage->pid > 0 && job->pgid == 0)
+        {
+            job->pgid = stage->pid;
+        }
+
+        if (out != 1)
+        {
+            close(out);
+        }
+        if (in != 0)
+        {
+            close(in);
+        }
+        in = fd[0];
+    }
+
+    if (background)
+    {
+        printf("[%d] %d\n", n + 1, job->pgid > 0 ? job->pgid : job->stages[num - 1].pid);
+    }
+    else
+    {
+        wait_job(job, &old);
+    }
+    restore_sigmask(&old);
+}
+
+// runs a builtin in the shell, or else starts the pipeline as a job
+// returns 0 if the shell should exit, or 1
+int exec_command(char ***stages, int num, int background, char *command)
+{
+    char **args = stages[0];
+    if (args == NULL || args[0] == NULL || strlen(args[0]) == 0)
     {
         // the command is null;
+        free(command);
         return 1;
     }
 
-    if (strcmp(args[0], exit_command) == 0)
+    struct builtin *builtin = find_builtin(args[0]);
+    if (num == 1 && builtin != NULL)
     {
-        // the command is exit;
-        return 0;
+        free(command);
+        return builtin->func(args);
     }
 
-    return exec_program(args);
+    run_job(stages, num, background, command);
+    return 1;
+}
+
+// removes a trailing & from a line
+// returns 1 if there was one (the line runs in the background), or 0
+int strip_background(char *line)
+{
+    size_t len = strlen(line);
+    while (len > 0 && strchr(DELIMITER, line[len - 1]) != NULL)
+    {
+        len--;
+    }
+    int background = len > 0 && line[len - 1] == '&';
+    if (background)
+    {
+        len--;
+        while (len > 0 && strchr(DELIMITER, line[len - 1]) != NULL)
+        {
+            len--;
+        }
+    }
+    line[len] = '\0';
+    return background;
 }
 
 char **split_line(char *line, int type)
@@ -137,7 +850,13 @@ char *jsh_readline()
     ssize_t linelen = getline(&line, &linecap, stdin);
     if (linelen < 0)
     {
-        fprintf(stderr, "an error occurs in getline func\n");
+        // end of input (a script, or ^D) ends the shell
+        if (!feof(stdin))
+        {
+            fprintf(stderr, "an error occurs in getline func\n");
+        }
+        free(line);
+        return NULL;
     }
     return line;
 }
@@ -153,61 +872,6 @@ int pipe_num(char **pipes)
     return i;
 }
 
-// designed for pipeline process, need to handle dup2()
-int spawn_proc(int in, int out, char *line, pid_t *pipes, int pipeNum)
-{
-    int rc;
-    // split the line to get command args.
-    char **args = split_line(line, 2);
-
-    rc = fork();
-    if (rc < 0)
-    {
-        // fork failed; exit
-        fprintf(stderr, "fork failed\n");
-        exit(1);
-    }
-    else if (rc == 0)
-    {
-        // child process
-        if (in != 0)
-        {
-            int fd = dup2(in, 0);
-            if (fd == -1)
-            {
-                printf("dup2 error\n");
-                exit(127);
-            }
-            close(in);
-        }
-
-        if (out != 1)
-        {
-            int fd = dup2(out, 1);
-            if (fd == -1)
-            {
-                printf("dup2 error\n");
-                exit(127);
-            }
-            close(out);
-        }
-
-        // set current pid_t
-        pipes[pipeNum] = getpid();
-
-        execvp(args[0], args);
-        printf("the command between pipeline is wrong, please check!\n");
-        exit(127);
-    }
-    else if (rc > 0)
-    {
-        // parent wait
-        // wait(NULL);
-    }
-
-    return 1;
-}
-
 void jsh_loop()
 {
     char *line;
@@ -216,119 +880,103 @@ void jsh_loop()
 
     // variable for pipe
     int i;
-    int in, fd[2];
 
     do
     {
+        sigset_t old;
+        block_sigchld(&old);
+        report_jobs();
+        restore_sigmask(&old);
+
         printf("jsh$ ");
         line = jsh_readline();
         if (line == NULL)
         {
-            continue;
+            break;
         }
+        add_history(line);
+        int background = strip_background(line);
+        char *command = strdup(line);
         // first split all the pipes
         pipes = split_line(line, 1);
 
         int num = pipe_num(pipes);
-        if (num <= 1)
+        char **stages[num > 0 ? num : 1];
+        stages[0] = NULL;
+        for (i = 0; i < num; i++)
         {
-            char **args = split_line(pipes[0], 2);
-            if (args == NULL)
-            {
-                continue;
-            }
-            int result = exec_command(args);
-            // command is exit, change status
-            if (result == 0)
-            {
-                status = 0;
-                break;
-            }
+            stages[i] = split_line(pipes[i], 2);
         }
-        else
+        int result = exec_command(stages, num > 0 ? num : 1, background, command);
+        for (i = 0; i < num; i++)
         {
-            // set first process input
-            in = 0;
-            pid_t pipePid[num];
-
-            // produce new process to execute command and pipe
-            for (i = 0; i < num - 1; ++i)
-            {
-                int pp_res = pipe(fd);
-                if (pp_res < 0)
-                {
-                    printf("pipe function error\n");
-                    exit(127);
-                }
-                sleep(0.5);
-                spawn_proc(in, fd[1], pipes[i], &pipePid[0], i);
-                close(fd[1]);
-                in = fd[0];
-            }
-
-            int rc;
-            char **args = split_line(pipes[num - 1], 2);
-
-            rc = fork();
-            if (rc < 0)
-            {
-                // fork failed; exit
-                fprintf(stderr, "fork failed\n");
-                exit(1);
-            }
-            else if (rc == 0)
-            {
-                /* Last part of the pipeline - set stdin to read end of the previous pipe
-                and output to the original file descriptor 1. */
-                if (in != 0)
-                {
-                    int fd = dup2(in, 0);
-                    if (fd == -1)
-                    {
-                        printf("dup2 error\n");
-                        exit(127);
-                    }
-                }
-
-                // set current pid_t
-                pipePid[num - 1] = getpid();
-
-                // Execute the last command.
-                execvp(args[0], args);
-                printf("the last command of pipeline is wrong, please check!\n");
-                exit(127);
-            }
-            else if (rc > 0)
-            {
-
-                for (i = 0; i < num - 1; i++)
-                {
-                    int stat;
-                    // wait for all pipe commands
-                    waitpid(pipePid[i], &stat, 0);
-                    if (WEXITSTATUS(stat) == 127)
-                    {
-                        printf("the command between pipeline is wrong, please check!\n");
-                    }
-                }
-                sleep(1);
-                // wait for last pipe command and print status
-                int statloc;
-                waitpid(pipePid[num - 1], &statloc, 0);
-                printf("jsh state: %d\n", WEXITSTATUS(statloc));
-            }
+            free(stages[i]);
         }
 
         free(line);
         free(pipes);
 
+        // command is exit, change status
+        if (result == 0)
+        {
+            status = 0;
+        }
     } while (status);
 }
 
+// puts the shell in its own process group in the foreground of the
+// terminal, if it has one, and reaps its children when SIGCHLD arrives
+void init_shell()
+{
+    sigemptyset(&sigchld_set);
+    sigaddset(&sigchld_set, SIGCHLD);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchld_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+
+    if (!isatty(STDIN_FILENO))
+    {
+        return;
+    }
+    // wait until a job-control shell that started us puts us in the foreground
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp()))
+    {
+        kill(-shell_pgid, SIGTTIN);
+    }
+    // ^C and ^Z are for the foreground job, not the shell
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+    shell_pgid = getpid();
+    if (setpgid(shell_pgid, shell_pgid) < 0 && getpgrp() != shell_pgid)
+    {
+        perror("setpgid");
+        // without job control the programs it starts must keep ^C working
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        return;
+    }
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    job_control = 1;
+}
+
 int main(int argc, char *argv[])
 {
     // printf("hello world (pid:%d)\n", (int) getpid());
 
+    // SIGCHLD is handled rather than left as whoever started the shell set
+    // it: if it were ignored, the kernel would reap children before
+    // waitpid() could report their status
+    init_shell();
+
     jsh_loop();
 
     return 0;
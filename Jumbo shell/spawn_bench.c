@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+// measures how many commands per second a shell can launch and wait for,
+// with fork() + execvp() (how jsh used to launch them) and with posix_spawnp()
+// (how it launches them now), as the shell's memory grows
+
+#define default_spawns 2000
+#define default_max_mb 256
+
+extern char **environ;
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int wait_child(pid_t pid)
+{
+    int statloc;
+    while (waitpid(pid, &statloc, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+    return statloc;
+}
+
+pid_t launch_fork(char **args)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execvp(args[0], args);
+        _exit(127);
+    }
+    return pid;
+}
+
+pid_t launch_spawn(char **args)
+{
+    pid_t pid;
+    if (posix_spawnp(&pid, args[0], NULL, NULL, args, environ) != 0)
+    {
+        return -1;
+    }
+    return pid;
+}
+
+// returns launches per second, or -1 if a launch failed
+double measure(pid_t (*launch)(char **), char **args, int spawns)
+{
+    double start = now();
+    int i;
+    for (i = 0; i < spawns; i++)
+    {
+        pid_t pid = launch(args);
+        if (pid < 0 || wait_child(pid) < 0)
+        {
+            return -1;
+        }
+    }
+    return spawns / (now() - start);
+}
+
+void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-n spawns] [-m max_mb] [program [arg ...]]\n", name);
+    fprintf(stderr, "  -n  launches per measurement (default %d)\n", default_spawns);
+    fprintf(stderr, "  -m  largest amount of touched memory to measure with, in MB (default %d)\n",
+            default_max_mb);
+    fprintf(stderr, "  program defaults to true\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int spawns = default_spawns;
+    int max_mb = default_max_mb;
+    int opt;
+    while ((opt = getopt(argc, argv, "+n:m:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            spawns = atoi(optarg);
+            break;
+        case 'm':
+            max_mb = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (spawns < 1 || max_mb < 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    char *default_args[] = {"true", NULL};
+    char **args = optind < argc ? &argv[optind] : default_args;
+
+    printf("%8s %14s %14s\n", "mem(MB)", "fork+exec/s", "posix_spawn/s");
+    // memory the shell has touched, grown 4x for each row
+    char *mem = NULL;
+    int mb = 0;
+    while (mb <= max_mb)
+    {
+        char *grown = realloc(mem, (size_t)mb * 1024 * 1024 + 1);
+        if (grown == NULL)
+        {
+            fprintf(stderr, "could not allocate %d MB\n", mb);
+            return 1;
+        }
+        mem = grown;
+        memset(mem, 1, (size_t)mb * 1024 * 1024 + 1);
+
+        double forked = measure(launch_fork, args, spawns);
+        double spawned = measure(launch_spawn, args, spawns);
+        if (forked < 0 || spawned < 0)
+        {
+            fprintf(stderr, "could not run %s\n", args[0]);
+            return 1;
+        }
+        printf("%8d %14.0f %14.0f\n", mb, forked, spawned);
+        mb = mb == 0 ? 1 : mb * 4;
+    }
+    free(mem);
+    return 0;
+}